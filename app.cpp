@@ -4,7 +4,49 @@
 
 using namespace std;
 
+#define MAX_DEV_BACKENDS 4
+
+static struct {
+    const char *dev;
+    NVM_DEV *backend;
+} dev_backends[MAX_DEV_BACKENDS];
+
+static NVM_DEV *find_backend(const char *dev) {
+    for(int i = 0; i < MAX_DEV_BACKENDS; i++) {
+        if(dev_backends[i].backend && 0 == strcmp(dev_backends[i].dev, dev)) {
+            return dev_backends[i].backend;
+        }
+    }
+    return NULL;
+}
+
+gpNvm_Result _register_dev(const char *dev, NVM_DEV *backend) {
+    int free_slot = -1;
+    for(int i = 0; i < MAX_DEV_BACKENDS; i++) {
+        if(dev_backends[i].backend && 0 == strcmp(dev_backends[i].dev, dev)) {
+            dev_backends[i].backend = backend;
+            return gpNvm_Result::SUCCESS;
+        }
+        if(!dev_backends[i].backend && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if(!backend) {
+        return gpNvm_Result::SUCCESS;
+    }
+    if(free_slot < 0) {
+        return gpNvm_Result::OUT_OF_MEM;
+    }
+    dev_backends[free_slot].dev = dev;
+    dev_backends[free_slot].backend = backend;
+    return gpNvm_Result::SUCCESS;
+}
+
 gpNvm_Result _write(char *dev, size_t offset, size_t length, void *data) {
+    NVM_DEV *backend = find_backend(dev);
+    if(backend) {
+        return backend->write(offset, length, data);
+    }
     fstream file;
     file.open(dev, ios::binary | std::ios_base::in | std::ios_base::out);
     if(!file) {
@@ -16,6 +58,10 @@ gpNvm_Result _write(char *dev, size_t offset, size_t length, void *data) {
     return gpNvm_Result::SUCCESS;
 }
 gpNvm_Result _read(char *dev, size_t offset, size_t length, void *data) {
+    NVM_DEV *backend = find_backend(dev);
+    if(backend) {
+        return backend->read(offset, length, data);
+    }
     fstream file;
     file.open(dev, ios::binary | std::ios_base::in);
     if(!file) {
@@ -27,6 +73,95 @@ gpNvm_Result _read(char *dev, size_t offset, size_t length, void *data) {
     return gpNvm_Result::SUCCESS;
 }
 
+// lz_compress format - a control byte below 0x80 is followed by (control + 1) literal bytes,
+// otherwise the lower 7 bits are the match length - LZ_MIN_MATCH, followed by a byte of distance - 1
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_WINDOW 0x100
+
+static bool lz_put_literals(const UInt8 *src, size_t n, UInt8 *dst, size_t dst_len, size_t &out) {
+    while(n) {
+        size_t run = (n > LZ_MAX_LITERALS) ? LZ_MAX_LITERALS : n;
+        if(out + 1 + run > dst_len) {
+            return false;
+        }
+        dst[out++] = run - 1;
+        memcpy(dst + out, src, run);
+        out += run;
+        src += run;
+        n -= run;
+    }
+    return true;
+}
+
+size_t lz_compress(const UInt8 *src, size_t len, UInt8 *dst, size_t dst_len) {
+    size_t in = 0, out = 0, literals = 0; // literals - start of the pending literal run
+    while(in < len) {
+        // greedy search for the longest match in the window, values are small enough for brute force
+        size_t best_len = 0, best_dist = 0;
+        for(size_t cand = (in > LZ_WINDOW) ? (in - LZ_WINDOW) : 0; cand < in; cand++) {
+            size_t n = 0;
+            while(in + n < len && n < LZ_MAX_MATCH && src[cand + n] == src[in + n]) {
+                n++;
+            }
+            if(n > best_len) {
+                best_len = n;
+                best_dist = in - cand;
+            }
+        }
+        if(best_len < LZ_MIN_MATCH) {
+            in++;
+            continue;
+        }
+        if(!lz_put_literals(src + literals, in - literals, dst, dst_len, out) || out + 2 > dst_len) {
+            return 0;
+        }
+        dst[out++] = 0x80 | (best_len - LZ_MIN_MATCH);
+        dst[out++] = best_dist - 1;
+        in += best_len;
+        literals = in;
+    }
+    if(!lz_put_literals(src + literals, in - literals, dst, dst_len, out)) {
+        return 0;
+    }
+    return out;
+}
+
+bool lz_decompress(const UInt8 *src, size_t src_len, UInt8 *dst, size_t len) {
+    size_t in = 0, out = 0;
+    while(out < len) {
+        if(in >= src_len) {
+            return false;
+        }
+        UInt8 control = src[in++];
+        if(control & 0x80) {
+            if(in >= src_len) {
+                return false;
+            }
+            size_t n = (control & 0x7F) + LZ_MIN_MATCH;
+            size_t dist = src[in++] + 1;
+            if(dist > out || out + n > len) {
+                return false;
+            }
+            // byte by byte, as the match may overlap the data being produced
+            for(; n; n--, out++) {
+                dst[out] = dst[out - dist];
+            }
+        }
+        else {
+            size_t n = control + 1;
+            if(in + n > src_len || out + n > len) {
+                return false;
+            }
+            memcpy(dst + out, src + in, n);
+            in += n;
+            out += n;
+        }
+    }
+    return true;
+}
+
 gpNvm_Result gpNvm_GetAttribute(gpNvm_AttrId attrId, UInt8 *length, UInt8 *pValue) {
     ATTR_TANK tank;
     return tank.get_attribute(attrId, length, pValue);
@@ -1,6 +1,8 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 #include <cstring>
+#include <algorithm>
 
 #include <iostream>
 
@@ -40,13 +42,70 @@ gpNvm_Result _write(char *dev, size_t offset, size_t length, void *data);
  */
 gpNvm_Result _read(char *dev, size_t offset, size_t length, void *data);
 
+/* @brief Memory device backend, which can be plugged in under _read/_write
+ * in place of the file of the same name
+ */
+class NVM_DEV {
+public:
+    virtual ~NVM_DEV() {}
+
+    /* @brief Read data from the device, same contract as _read */
+    virtual gpNvm_Result read(size_t offset, size_t length, void *data) = 0;
+
+    /* @brief Write data to the device, same contract as _write */
+    virtual gpNvm_Result write(size_t offset, size_t length, void *data) = 0;
+};
+
+/* @brief Route _read/_write of a device to a backend
+ *
+ * @param[in] dev       - device name, which must outlive the registration
+ * @param[in] backend   - backend to use, NULL to unregister
+ *
+ * @return gpNvm_Result, OUT_OF_MEM if too many backends are registered
+ */
+gpNvm_Result _register_dev(const char *dev, NVM_DEV *backend);
+
+/* @brief Compress data with a small LZ77 variant, suited for values up to a few hundred bytes
+ *
+ * @param[in] src       - data to be compressed
+ * @param[in] len       - length of data
+ * @param[out] dst      - buffer to fill the compressed data
+ * @param[in] dst_len   - size of dst
+ *
+ * @return length of compressed data, 0 if it does not fit in dst_len
+ */
+size_t lz_compress(const UInt8 *src, size_t len, UInt8 *dst, size_t dst_len);
+
+/* @brief Decompress data compressed by lz_compress
+ *
+ * @param[in] src       - compressed data
+ * @param[in] src_len   - length of compressed data
+ * @param[out] dst      - buffer to fill the decompressed data
+ * @param[in] len       - length of decompressed data
+ *
+ * @return true on success, false if src is malformed
+ */
+bool lz_decompress(const UInt8 *src, size_t src_len, UInt8 *dst, size_t len);
+
 typedef struct CacheElement {
     bool keep;
     size_t pageId;
     bool updated;
+    size_t last_used; // access tick, for LRU replacement
     UInt8 *mem;
 } cache_t;
 
+#define MAX_PARTITIONS 8
+
+/* Partition - a range of pages owned by one user of a shared NVM,
+ * with a share of its cache
+ */
+typedef struct {
+    size_t first_page;
+    size_t num_pages;
+    size_t cache_quota; // max pages in cache, 0 for no limit
+} partition_t;
+
 /* @brief Abstraction of Non volatile memory with
  * paging, caching, error detection and correction support
  */
@@ -61,6 +120,47 @@ private:
     bool with_redundancy;
     size_t cache_size; // cache size in num of pages in cache
     cache_t *cache;
+    size_t tick; // cache access counter
+    partition_t parts[MAX_PARTITIONS];
+    int num_parts;
+
+    /* @brief Get the partition a page belongs to
+     *
+     * @param[in] pageId    - logical page id
+     *
+     * @return partition id, -1 if the page is not partitioned
+     */
+    int get_partition_of(size_t pageId) {
+        for(int p = 0; p < num_parts; p++) {
+            if(pageId >= parts[p].first_page && pageId < parts[p].first_page + parts[p].num_pages) {
+                return p;
+            }
+        }
+        return -1;
+    }
+
+    /* @brief Pick the cache element to swap out for a page - the least recently used one,
+     * only among the pages of the same partition if that is at its cache quota. So the
+     * cache is shared by demand, while a partition can not take more than its quota
+     *
+     * @param[in] pageId    - logical page id to cache
+     *
+     * @return index of cache element, -1 if none can be swapped out
+     */
+    int pick_victim(size_t pageId) {
+        int part = get_partition_of(pageId);
+        bool at_quota = part >= 0 && parts[part].cache_quota && get_cache_pages(part) >= parts[part].cache_quota;
+        int victim = -1;
+        for(int i = 0; i < cache_size; i++) {
+            if(cache[i].keep || (at_quota && get_partition_of(cache[i].pageId) != part)) {
+                continue;
+            }
+            if(victim < 0 || cache[i].last_used < cache[victim].last_used) {
+                victim = i;
+            }
+        }
+        return victim;
+    }
 
     /* @brief Get a page from cache
      *
@@ -85,58 +185,62 @@ private:
      * @return gpNvm_Result
      */
     gpNvm_Result swap_page(size_t pageId, int &c) {
-        // TODO: Implement one of the caching algorithms like LRU
-        gpNvm_Result rc = gpNvm_Result::PAGE_FAULT;
-        for(int i = 0; i < cache_size; i++) {
-            // find a page which can be cached out
-            if(!cache[i].keep) {
-                rc = gpNvm_Result::SUCCESS;
-                // write it to memory only if there are updates
-                if(cache[i].updated) {
-                    // Update checksum
-                    UInt8 chksum = chksum8(cache[i].mem, data_page_size);
-                    cache[i].mem[raw_page_size-checksum_size] = chksum;
-                    rc = _write(dev, cache[i].pageId * raw_page_size, raw_page_size, cache[i].mem);
-                    if(with_redundancy) {
-                        rc = _write(dev, (cache[i].pageId + num_redundant_pages) * raw_page_size, raw_page_size, cache[i].mem);
-                        if(rc != gpNvm_Result::SUCCESS) {
-                            break;
-                        }
-                    }
+        int i = pick_victim(pageId);
+        if(i < 0) {
+            return gpNvm_Result::PAGE_FAULT;
+        }
+        gpNvm_Result rc = gpNvm_Result::SUCCESS;
+        do {
+            // write it to memory only if there are updates
+            if(cache[i].updated) {
+                // Update checksum
+                UInt8 chksum = chksum8(cache[i].mem, data_page_size);
+                cache[i].mem[raw_page_size-checksum_size] = chksum;
+                rc = _write(dev, cache[i].pageId * raw_page_size, raw_page_size, cache[i].mem);
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
                 }
-                // swap in the requested page
-                if(rc == gpNvm_Result::SUCCESS) {
-                    memset(cache[i].mem, 0, raw_page_size);
-                    rc = _read(dev, pageId * raw_page_size, raw_page_size, cache[i].mem);
-                    if(rc == gpNvm_Result::SUCCESS) {
-                        // Check for mem corruption
-                        UInt8 chksum = chksum8(cache[i].mem, data_page_size);
-                        if(chksum != cache[i].mem[raw_page_size-checksum_size]) {
-                            if(with_redundancy) {
-                                // read from redundant page
-                                rc = _read(dev, (pageId + num_redundant_pages) * raw_page_size, raw_page_size, cache[i].mem);
-                                if(rc == gpNvm_Result::SUCCESS) {
-                                    chksum = chksum8(cache[i].mem, data_page_size);
-                                    if(chksum != cache[i].mem[raw_page_size-checksum_size]) {
-                                        return gpNvm_Result::MEM_CORRUPTION;
-                                    }
-                                    // write back to corrutped page - mem correction
-                                    rc = _write(dev, cache[i].pageId * raw_page_size, raw_page_size, cache[i].mem);
-                                }
-                            }
-                            else {
-                                return gpNvm_Result::MEM_CORRUPTION;
-                            }
-                        }
+                if(with_redundancy) {
+                    rc = _write(dev, (cache[i].pageId + num_redundant_pages) * raw_page_size, raw_page_size, cache[i].mem);
+                    if(rc != gpNvm_Result::SUCCESS) {
+                        break;
                     }
                 }
-                if(rc == gpNvm_Result::SUCCESS) {
-                    cache[i].pageId = pageId;
-                    c = i;
-                }
+                cache[i].updated = false;
+            }
+            // swap in the requested page
+            // invalidate the element until the page is read successfully
+            cache[i].pageId = num_pages;
+            cache[i].last_used = 0;
+            memset(cache[i].mem, 0, raw_page_size);
+            rc = _read(dev, pageId * raw_page_size, raw_page_size, cache[i].mem);
+            if(rc != gpNvm_Result::SUCCESS) {
                 break;
             }
-        }
+            // Check for mem corruption
+            UInt8 chksum = chksum8(cache[i].mem, data_page_size);
+            if(chksum != cache[i].mem[raw_page_size-checksum_size]) {
+                if(!with_redundancy) {
+                    return gpNvm_Result::MEM_CORRUPTION;
+                }
+                // read from redundant page
+                rc = _read(dev, (pageId + num_redundant_pages) * raw_page_size, raw_page_size, cache[i].mem);
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
+                chksum = chksum8(cache[i].mem, data_page_size);
+                if(chksum != cache[i].mem[raw_page_size-checksum_size]) {
+                    return gpNvm_Result::MEM_CORRUPTION;
+                }
+                // write back to corrutped page - mem correction
+                rc = _write(dev, pageId * raw_page_size, raw_page_size, cache[i].mem);
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
+            }
+            cache[i].pageId = pageId;
+            c = i;
+        } while(0);
         return rc;
     }
 
@@ -165,10 +269,13 @@ public:
         cache_size  = i_cache_size;
         cache       = new cache_t[cache_size];
         with_redundancy = i_with_mem_correction;
+        tick        = 0;
+        num_parts   = 0;
         for(int i = 0; i < cache_size; i++) {
             cache[i].keep    = 0;
             cache[i].pageId  = num_pages; // one past last page as invalid id, because 0 is valid page
             cache[i].updated = 0;
+            cache[i].last_used = 0;
             cache[i].mem     = new UInt8[raw_page_size];
         }
         checksum_size = sizeof(UInt8);
@@ -199,9 +306,9 @@ public:
      * @return gpNvm_Result
      */
     gpNvm_Result read(size_t pageId, void *mem, size_t len, size_t offset=0) {
-        size_t pages_read = 0;
+        size_t bytes_read = 0;
         while(len) {
-            if(pageId >= num_pages) {
+            if(pageId >= num_redundant_pages) {
                 return gpNvm_Result::OUT_OF_MEM;
             }
             // see if the requested page is in cache
@@ -213,13 +320,14 @@ public:
                     return rc;
                 }
             }
+            cache[c].last_used = ++tick;
 
             // calculate the bytes of relevant data in the current page
-            size_t bytes = (len > data_page_size) ? (data_page_size - offset) : len;
-            memcpy((UInt8*)mem+(pages_read * data_page_size), cache[c].mem+offset, bytes);
+            size_t bytes = (offset + len > data_page_size) ? (data_page_size - offset) : len;
+            memcpy((UInt8*)mem+bytes_read, cache[c].mem+offset, bytes);
             len -= bytes;
             pageId++;
-            pages_read++;
+            bytes_read += bytes;
             offset = 0; // since data is contiguous it has to begin from 0 of next page
         }
 
@@ -236,9 +344,9 @@ public:
      * @return gpNvm_Result
      */
     gpNvm_Result write(size_t pageId, void *mem, size_t len, size_t offset=0) {
-        size_t pages_written = 0;
+        size_t bytes_written = 0;
         while(len) {
-            if(pageId >= num_pages) {
+            if(pageId >= num_redundant_pages) {
                 return gpNvm_Result::OUT_OF_MEM;
             }
             // see if the requested page is in cache
@@ -250,14 +358,15 @@ public:
                     return rc;
                 }
             }
+            cache[c].last_used = ++tick;
             // mark as updated to that next cache flush commits it to memory
             cache[c].updated = true;
             // calculate the bytes of relevant data in the current page
-            size_t bytes = (len > data_page_size) ? (data_page_size-offset) : len;
-            memcpy(cache[c].mem+offset, (UInt8*)mem+(pages_written * data_page_size), bytes);
+            size_t bytes = (offset + len > data_page_size) ? (data_page_size-offset) : len;
+            memcpy(cache[c].mem+offset, (UInt8*)mem+bytes_written, bytes);
             len -= bytes;
             pageId++;
-            pages_written++;
+            bytes_written += bytes;
             offset = 0; // since data is contiguous it has to begin from 0 of next page
         }
 
@@ -285,6 +394,7 @@ public:
                         break;
                     }
                 }
+                cache[i].updated = false;
             }
         }
         return rc;
@@ -297,6 +407,66 @@ public:
     size_t get_page_size(void) {
         return data_page_size;
     }
+
+    /* @brief Get number of logical pages available for data, excluding the mirror
+     *
+     * @return number of pages
+     */
+    size_t get_num_pages(void) {
+        return num_redundant_pages;
+    }
+
+    /* @brief Reserve a range of pages for one user of the NVM, e.g. an ATTR_TANK namespace
+     *
+     * @param[in] first_page    - first logical page of the partition
+     * @param[in] num_pages     - number of pages in the partition
+     * @param[in] cache_quota   - max number of its pages in cache, 0 for no limit
+     * @param[out] part         - partition id
+     *
+     * @return gpNvm_Result, OUT_OF_MEM if the range is out of memory, overlaps
+     *         another partition or there are too many partitions
+     */
+    gpNvm_Result add_partition(size_t first_page, size_t num_pages, size_t cache_quota, int &part) {
+        if(num_parts >= MAX_PARTITIONS || !num_pages || first_page + num_pages > num_redundant_pages) {
+            return gpNvm_Result::OUT_OF_MEM;
+        }
+        for(int p = 0; p < num_parts; p++) {
+            if(first_page < parts[p].first_page + parts[p].num_pages && parts[p].first_page < first_page + num_pages) {
+                return gpNvm_Result::OUT_OF_MEM;
+            }
+        }
+        parts[num_parts].first_page  = first_page;
+        parts[num_parts].num_pages   = num_pages;
+        parts[num_parts].cache_quota = cache_quota;
+        part = num_parts++;
+        return gpNvm_Result::SUCCESS;
+    }
+
+    /* @brief Get a partition
+     *
+     * @param[in] part      - partition id
+     *
+     * @return partition, NULL if there is no such partition
+     */
+    const partition_t *get_partition(int part) {
+        return (part >= 0 && part < num_parts) ? &parts[part] : NULL;
+    }
+
+    /* @brief Get number of pages of a partition currently in cache
+     *
+     * @param[in] part      - partition id
+     *
+     * @return number of pages
+     */
+    size_t get_cache_pages(int part) {
+        size_t pages = 0;
+        for(int i = 0; i < cache_size; i++) {
+            if(cache[i].pageId < num_redundant_pages && get_partition_of(cache[i].pageId) == part) {
+                pages++;
+            }
+        }
+        return pages;
+    }
 };
 
 #define ATTR_TANK_DEV "ATTR_TANK.dat"
@@ -304,75 +474,791 @@ public:
 #define PAGE_SIZE 1024
 #define NUM_PAGES 50
 #define CACHE_SIZE 2
+#define INIT_SEQ_STR "CDR6" // version 6 of the compact directory layout - entries staged during conversion
+#define INIT_SEQ_FAMILY 3 // length of the INIT_SEQ prefix shared by all versions of the directory layout
+#define LEGACY_INIT_SEQ_STR "CODE" // metadata layout before the directory checkpoint
+#define INLINE_MAX_SIZE 4 // values up to this size are kept in the directory entry itself
+#define NUM_SLAB_CLASSES 3
+#define SLAB_MIN_SIZE 8 // slot size of the smallest slab class, doubling for each next class
+
+// dir_entry_t flags
+#define ATTR_INLINE     0x01
+#define ATTR_SLAB       0x02
+#define ATTR_COMPRESSED 0x04
 
 typedef struct {
     size_t len;
     size_t page;
     size_t offset;
-} attr_info_t;
+} legacy_attr_info_t;
 
+/* Metadata of the legacy layout, stored at PAGE_0 - a fixed map of all attributes.
+ * Mounting a tank in this layout converts it to the directory checkpoint
+ */
 typedef struct {
     size_t current_page;
     size_t current_offset;
     uint8_t INIT_SEQ[5];
-    attr_info_t ATTR_MAP[MAX_ATTRIBUTES];
-} meta_t;
+    legacy_attr_info_t ATTR_MAP[MAX_ATTRIBUTES];
+} legacy_meta_t;
+
+/* Header of the directory checkpoint, stored at the beginning of PAGE_0
+ * and followed by num_entries packed dir_entry_t records
+ */
+typedef struct {
+    uint8_t INIT_SEQ[5];
+    uint8_t clean; // set on orderly shutdown, cleared by the first update of a session after PAGE_0
+    uint16_t num_entries;
+    uint32_t current_page;
+    uint32_t current_offset;
+    uint32_t slab_floor; // lowest page used by slabs, which are carved from the top of the tank
+    uint32_t stage_page; // page of the entries after PAGE_0 staged by a conversion from the legacy layout, 0 if none
+} dir_hdr_t;
+
+typedef struct {
+    uint16_t page;
+    uint16_t offset;
+} attr_loc_t;
+
+/* Directory entry - a single attribute, either its value or its location in NVM */
+typedef struct {
+    union {
+        attr_loc_t loc;
+        uint8_t value[INLINE_MAX_SIZE];
+    };
+    uint8_t attrId;
+    uint8_t len;
+    uint8_t size; // bytes stored, less than len if compressed
+    uint8_t cap; // bytes reserved at loc
+    uint8_t flags;
+    uint8_t pad;
+} dir_entry_t;
+
+/* Bytes of the tank held by the value of a directory entry */
+typedef struct {
+    size_t start;
+    size_t end;
+    bool slab;
+} attr_region_t;
+
+enum class attr_state_t : UInt8 {
+    UNCHECKED,
+    VALID,
+    CORRUPT
+};
 
 /* ATTR_TANK - an abstraction for the attributes container,
  * providing init, getter and setter methods
  */
 class ATTR_TANK {
 private:
-    meta_t meta;
+    dir_hdr_t hdr;
+    dir_entry_t dir[MAX_ATTRIBUTES]; // in-RAM copy of the directory, in checkpoint order
+    uint16_t slot[MAX_ATTRIBUTES]; // attribute id -> index in dir + 1, 0 if never set
+    attr_state_t state[MAX_ATTRIBUTES]; // lazy validation state per attribute
+    size_t dir_pages; // pages reserved for the directory
+    bool dirty; // directory on device is marked as not cleanly shut down
+    bool with_compression;
+    gpNvm_Result mount_rc;
     NVM *mem;
-public:
-    ATTR_TANK() {
-        mem = new NVM(ATTR_TANK_DEV, PAGE_SIZE, NUM_PAGES, CACHE_SIZE);
+    bool own_mem; // if mem is private to the tank, rather than shared by namespaces
+    size_t base_page; // first page of the tank in mem
+    size_t num_pages; // number of pages of the tank
+
+    /* @brief Read from a page of the tank, bounded to the tank
+     *
+     * @return gpNvm_Result, same as NVM::read
+     */
+    gpNvm_Result nvm_read(size_t pageId, void *buf, size_t len, size_t offset=0) {
+        if(len && pageId + ((offset + len - 1) / mem->get_page_size()) >= num_pages) {
+            return gpNvm_Result::OUT_OF_MEM;
+        }
+        return mem->read(base_page + pageId, buf, len, offset);
+    }
+
+    /* @brief Write to a page of the tank, bounded to the tank
+     *
+     * @return gpNvm_Result, same as NVM::write
+     */
+    gpNvm_Result nvm_write(size_t pageId, void *buf, size_t len, size_t offset=0) {
+        if(len && pageId + ((offset + len - 1) / mem->get_page_size()) >= num_pages) {
+            return gpNvm_Result::OUT_OF_MEM;
+        }
+        return mem->write(base_page + pageId, buf, len, offset);
+    }
+
+    size_t slab_size(size_t cls) {
+        return SLAB_MIN_SIZE << cls;
+    }
+
+    /* @brief Get the smallest slab class fitting a value
+     *
+     * @param[in] length    - length of the value
+     *
+     * @return slab class, NUM_SLAB_CLASSES if the value is too big for a slab
+     */
+    size_t slab_class(size_t length) {
+        size_t cls = 0;
+        while(cls < NUM_SLAB_CLASSES && slab_size(cls) < length) {
+            cls++;
+        }
+        return cls;
+    }
+
+    /* @brief Position one past the last allocated byte in the data area
+     *
+     * @return position in bytes
+     */
+    size_t tail(void) {
+        return (hdr.current_page * mem->get_page_size()) + hdr.current_offset;
+    }
+
+    /* @brief Number of directory entries sharing PAGE_0 with the header, which are written
+     * along with it in a single page write
+     */
+    size_t page0_entries(void) {
+        return (mem->get_page_size() - sizeof(dir_hdr_t)) / sizeof(dir_entry_t);
+    }
+
+    /* @brief Position of a directory entry - entries follow the header, but never
+     * straddle a page, so that each of them is written atomically
+     *
+     * @param[in] i     - index of the entry in the directory
+     *
+     * @return position in bytes
+     */
+    size_t entry_pos(size_t i) {
+        size_t page_size = mem->get_page_size();
+        size_t first = page0_entries();
+        if(i < first) {
+            return sizeof(dir_hdr_t) + (i * sizeof(dir_entry_t));
+        }
+        size_t per_page = page_size / sizeof(dir_entry_t);
+        i -= first;
+        return ((1 + (i / per_page)) * page_size) + ((i % per_page) * sizeof(dir_entry_t));
+    }
 
-        // read page 0
-        mem->read(0, &meta, sizeof(meta), 0);
+    gpNvm_Result write_hdr(void) {
+        return nvm_write(0, &hdr, sizeof(hdr), 0);
+    }
+
+    /* @brief Write a single directory entry in place
+     *
+     * @param[in] i     - index of the entry in the directory
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result write_entry(size_t i) {
+        size_t pos = entry_pos(i);
+        return nvm_write(pos / mem->get_page_size(), &dir[i], sizeof(dir_entry_t), pos % mem->get_page_size());
+    }
+
+    /* @brief Reserve space for a value, packing small values into slab pages
+     * shared with other values of the same size class. Space no longer held by
+     * any entry is reused - the entry being updated still holds its old value,
+     * so that it stays intact until the new entry is committed
+     *
+     * @param[in,out] e     - directory entry to point at the reserved space
+     * @param[in] length    - length of the value
+     * @param[in] low       - position in bytes to allocate from, by default the start of the data area
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result allocate(dir_entry_t &e, UInt8 length, size_t low=0) {
+        size_t page_size = mem->get_page_size();
+        size_t floor = num_pages; // lowest page holding a slab slot
+        size_t top = std::max(dir_pages * page_size, low); // one past the last byte of an extent
 
-        if(strcmp((const char*)meta.INIT_SEQ, "CODE")) {
-            // First time init
-            meta.current_page = 1 + (sizeof(meta_t) / mem->get_page_size());
-            meta.current_offset = 0;
-            strcpy((char*)meta.INIT_SEQ, "CODE");
-            memset(meta.ATTR_MAP, 0, sizeof(meta.ATTR_MAP));
+        // the directory is small enough to derive the free space from it on each allocation
+        attr_region_t used[MAX_ATTRIBUTES];
+        size_t n = 0;
+        for(size_t i = 0; i < hdr.num_entries; i++) {
+            const dir_entry_t &d = dir[i];
+            if((d.flags & ATTR_INLINE) || !entry_valid(d)) {
+                continue;
+            }
+            used[n].start = (d.loc.page * page_size) + d.loc.offset;
+            used[n].end = used[n].start + d.cap;
+            used[n].slab = d.flags & ATTR_SLAB;
+            if(used[n].slab) {
+                floor = std::min(floor, (size_t)d.loc.page);
+            }
+            else {
+                top = std::max(top, used[n].end);
+            }
+            n++;
+        }
+        // extents all lie below the slab pages
+        std::sort(used, used + n, [](const attr_region_t &x, const attr_region_t &y) { return x.start < y.start; });
 
-            // write to NVM
-            mem->write(0, &meta, sizeof(meta), 0);
-            mem->cache_flush();
+        size_t cls = slab_class(length);
+        if(cls < NUM_SLAB_CLASSES) {
+            size_t cap = slab_size(cls);
+            size_t page = 0, slot = 0;
+            size_t empty = 0, next = floor; // an empty slab page if any, next slab page expected
+            for(size_t k = 0; k < n && !page; ) {
+                if(!used[k].slab) {
+                    k++;
+                    continue;
+                }
+                size_t p = used[k].start / page_size;
+                if(p > next && !empty) {
+                    empty = next;
+                }
+                next = p + 1;
+                size_t first = k;
+                while(k < n && used[k].start / page_size == p) {
+                    k++;
+                }
+                if(used[first].end - used[first].start != cap) {
+                    continue;
+                }
+                // first free slot of a page of the class
+                size_t s = 0;
+                for(size_t j = first; j < k && used[j].start % page_size == s * cap; j++) {
+                    s++;
+                }
+                if(s < page_size / cap) {
+                    page = p;
+                    slot = s;
+                }
+            }
+            if(!page && !empty && next < num_pages) {
+                empty = next;
+            }
+            if(!page && empty) {
+                page = empty;
+            }
+            if(!page) {
+                // carve a new slab page below the lowest one
+                if(top > (floor - 1) * page_size) {
+                    return gpNvm_Result::OUT_OF_MEM;
+                }
+                page = floor - 1;
+            }
+            e.flags = ATTR_SLAB;
+            e.cap = cap;
+            e.loc.page = page;
+            e.loc.offset = slot * cap;
+            floor = std::min(floor, page);
         }
+        else {
+            // first gap between extents that fits the value
+            size_t start = std::max(dir_pages * page_size, low);
+            for(size_t k = 0; k < n && !used[k].slab && used[k].start < start + length; k++) {
+                start = std::max(start, used[k].end);
+            }
+            if(start + length > floor * page_size) {
+                return gpNvm_Result::OUT_OF_MEM;
+            }
+            e.flags = 0;
+            e.cap = length;
+            e.loc.page = start / page_size;
+            e.loc.offset = start % page_size;
+            top = std::max(top, start + length);
+        }
+        hdr.slab_floor = floor;
+        hdr.current_page = top / page_size;
+        hdr.current_offset = top % page_size;
+        return gpNvm_Result::SUCCESS;
+    }
+
+    /* @brief Check that an entry lies within the area it was allocated from
+     *
+     * @param[in] e     - directory entry
+     *
+     * @return true if the entry is sane
+     */
+    bool entry_valid(const dir_entry_t &e) {
+        size_t page_size = mem->get_page_size();
+        if(!(e.flags & ATTR_COMPRESSED) && e.size != e.len) {
+            return false;
+        }
+        if(e.flags & ATTR_INLINE) {
+            return e.size <= INLINE_MAX_SIZE;
+        }
+        if(e.size > e.cap || e.loc.offset >= page_size) {
+            return false;
+        }
+        if(e.flags & ATTR_SLAB) {
+            return e.loc.page >= hdr.slab_floor && e.loc.page < num_pages && e.loc.offset + e.cap <= page_size;
+        }
+        size_t start = (e.loc.page * page_size) + e.loc.offset;
+        return e.loc.page >= dir_pages && start + e.cap <= tail();
+    }
+
+    /* @brief Validate the entry of an attribute on its first access after mount
+     *
+     * @param[in] attrId    - attribute id, which must have been set
+     *
+     * @return validation state of the attribute
+     */
+    attr_state_t check(gpNvm_AttrId attrId) {
+        if(state[attrId] == attr_state_t::UNCHECKED) {
+            state[attrId] = entry_valid(dir[slot[attrId]-1]) ? attr_state_t::VALID : attr_state_t::CORRUPT;
+        }
+        return state[attrId];
+    }
+
+    /* @brief First time init of an empty directory
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result format(void) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.INIT_SEQ, INIT_SEQ_STR, sizeof(hdr.INIT_SEQ));
+        hdr.clean = 1;
+        hdr.current_page = dir_pages;
+        hdr.current_offset = 0;
+        hdr.slab_floor = num_pages;
+
+        gpNvm_Result rc = write_hdr();
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = mem->cache_flush();
+        }
+        return rc;
+    }
+
+    /* @brief Check if a page was never written, i.e. holds only 0x00 or erased 0xFF bytes
+     *
+     * @param[in] pageId    - page of the tank
+     *
+     * @return true if the page is blank
+     */
+    bool page_blank(size_t pageId) {
+        size_t page_size = mem->get_page_size();
+        UInt8 *buf = new UInt8[page_size];
+        bool blank = nvm_read(pageId, buf, page_size, 0) == gpNvm_Result::SUCCESS;
+        for(size_t i = 0; i < page_size && blank; i++) {
+            blank = (buf[i] == buf[0]) && (buf[0] == 0x00 || buf[0] == 0xFF);
+        }
+        delete []buf;
+        return blank;
+    }
+
+    /* @brief Move the directory entries staged by migrate to their place after PAGE_0
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result unstage(void) {
+        size_t first = page0_entries();
+        gpNvm_Result rc = nvm_read(hdr.stage_page, &dir[first], (hdr.num_entries - first) * sizeof(dir_entry_t), 0);
+        for(size_t i = first; i < hdr.num_entries && rc == gpNvm_Result::SUCCESS; i++) {
+            rc = write_entry(i);
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = mem->cache_flush();
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            hdr.stage_page = 0;
+            rc = write_hdr();
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = mem->cache_flush();
+        }
+        return rc;
+    }
+
+    /* @brief Convert a tank in the legacy layout to the directory checkpoint. The values stay
+     * where they are, so only the directory is written - the entries after PAGE_0, which would
+     * overwrite the legacy map, are staged above the values first. The tank then switches over
+     * with a single write of PAGE_0, so that a power loss leaves either the legacy tank or the
+     * converted one, whose staged entries are moved in place on the next mount
+     *
+     * @return gpNvm_Result, MEM_CORRUPTION if any attribute could not be converted
+     */
+    gpNvm_Result migrate(void) {
+        size_t page_size = mem->get_page_size();
+        legacy_meta_t *legacy = new legacy_meta_t;
+        gpNvm_Result rc = nvm_read(0, legacy, sizeof(legacy_meta_t), 0);
+        gpNvm_Result map_rc = gpNvm_Result::SUCCESS;
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.INIT_SEQ, INIT_SEQ_STR, sizeof(hdr.INIT_SEQ));
+        hdr.clean = 1;
+        hdr.slab_floor = num_pages;
+        // legacy values start right after the map, which is free space once converted
+        size_t low = (1 + (sizeof(legacy_meta_t) / page_size)) * page_size;
+        size_t top = low;
+        for(size_t a = 0; a < MAX_ATTRIBUTES && rc == gpNvm_Result::SUCCESS; a++) {
+            const legacy_attr_info_t &info = legacy->ATTR_MAP[a];
+            size_t start = (info.page * page_size) + info.offset;
+            if(!info.len) {
+                continue;
+            }
+            if(info.len > UINT8_MAX || info.offset >= page_size || start < low || start + info.len > num_pages * page_size) {
+                map_rc = gpNvm_Result::MEM_CORRUPTION;
+                continue;
+            }
+            dir_entry_t &e = dir[hdr.num_entries];
+            memset(&e, 0, sizeof(e));
+            e.attrId = a;
+            e.len = info.len;
+            e.size = info.len;
+            e.cap = info.len;
+            e.loc.page = info.page;
+            e.loc.offset = info.offset;
+            slot[a] = ++hdr.num_entries;
+            top = std::max(top, start + info.len);
+        }
+        delete legacy;
+        hdr.current_page = top / page_size;
+        hdr.current_offset = top % page_size;
+
+        size_t first = page0_entries();
+        if(rc == gpNvm_Result::SUCCESS && hdr.num_entries > first) {
+            hdr.stage_page = (top + page_size - 1) / page_size;
+            size_t len = (hdr.num_entries - first) * sizeof(dir_entry_t);
+            rc = (hdr.stage_page * page_size) + len > num_pages * page_size ? gpNvm_Result::OUT_OF_MEM :
+                 nvm_write(hdr.stage_page, &dir[first], len, 0);
+            if(rc == gpNvm_Result::SUCCESS) {
+                rc = mem->cache_flush();
+            }
+        }
+
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = write_hdr();
+        }
+        for(size_t i = 0; i < first && i < hdr.num_entries && rc == gpNvm_Result::SUCCESS; i++) {
+            rc = write_entry(i);
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = mem->cache_flush();
+        }
+        if(rc == gpNvm_Result::SUCCESS && hdr.stage_page) {
+            rc = unstage();
+        }
+        return (rc == gpNvm_Result::SUCCESS) ? map_rc : rc;
+    }
+
+    /* @brief Full verification after an unclean shutdown - recovers the allocation
+     * pointers, verifies (and repairs from the mirror) every allocated page and
+     * validates all entries up front
+     */
+    void verify(void) {
+        size_t page_size = mem->get_page_size();
+        // the header may have missed the last allocation if power was lost in between
+        for(size_t i = 0; i < hdr.num_entries; i++) {
+            const dir_entry_t &e = dir[i];
+            if((e.flags & ATTR_INLINE) || e.loc.offset >= page_size || e.loc.page >= num_pages) {
+                continue;
+            }
+            if(e.flags & ATTR_SLAB) {
+                size_t cls = slab_class(e.cap);
+                if(cls < NUM_SLAB_CLASSES && slab_size(cls) == e.cap && e.loc.page < hdr.slab_floor) {
+                    hdr.slab_floor = e.loc.page;
+                }
+            }
+            else {
+                size_t end = (e.loc.page * page_size) + e.loc.offset + e.cap;
+                if(end <= num_pages * page_size && end > tail()) {
+                    hdr.current_page = end / page_size;
+                    hdr.current_offset = end % page_size;
+                }
+            }
+        }
+
+        for(size_t p = 0; p < num_pages; p++) {
+            UInt8 byte;
+            if(p > hdr.current_page && p < hdr.slab_floor) {
+                continue;
+            }
+            if(nvm_read(p, &byte, sizeof(byte), 0) == gpNvm_Result::SUCCESS) {
+                continue;
+            }
+            mount_rc = gpNvm_Result::MEM_CORRUPTION;
+            for(size_t i = 0; i < hdr.num_entries; i++) {
+                if(dir[i].flags & ATTR_INLINE) {
+                    continue;
+                }
+                size_t first = dir[i].loc.page;
+                size_t last = ((dir[i].loc.page * page_size) + dir[i].loc.offset + dir[i].cap) / page_size;
+                if(p >= first && p <= last) {
+                    state[dir[i].attrId] = attr_state_t::CORRUPT;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < hdr.num_entries; i++) {
+            check(dir[i].attrId);
+        }
+        // device is already marked unclean, the recovered header is committed on shutdown
+        dirty = true;
+    }
+
+    /* @brief Mark the directory on device as in use, so that a crash before
+     * the next orderly shutdown triggers full verification on mount
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result mark_dirty(void) {
+        hdr.clean = 0;
+        gpNvm_Result rc = write_hdr();
+        if(rc == gpNvm_Result::SUCCESS) {
+            rc = mem->cache_flush();
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            dirty = true;
+        }
+        return rc;
+    }
+
+    /* @brief Mount the tank from the directory checkpoint, formatting it on first use.
+     * A tank in the legacy layout is converted, while the tank is left untouched and
+     * unusable if PAGE_0 can not be read, or holds neither of the layouts and is not blank
+     */
+    void mount(void) {
+        dir_pages = 1 + (entry_pos(MAX_ATTRIBUTES - 1) / mem->get_page_size());
+        dirty = false;
+        memset(slot, 0, sizeof(slot));
+        memset(state, 0, sizeof(state));
+        memset(&hdr, 0, sizeof(hdr));
+        if(num_pages <= dir_pages) {
+            // no room for any data next to the directory
+            mount_rc = gpNvm_Result::OUT_OF_MEM;
+            num_pages = 0;
+            return;
+        }
+
+        // the directory follows the header, so mounting reads only its used part
+        mount_rc = nvm_read(0, &hdr, sizeof(hdr), 0);
+        if(mount_rc != gpNvm_Result::SUCCESS) {
+            num_pages = 0;
+            return;
+        }
+        if(memcmp(hdr.INIT_SEQ, INIT_SEQ_STR, sizeof(hdr.INIT_SEQ))) {
+            UInt8 legacy_seq[sizeof(hdr.INIT_SEQ)] = {};
+            nvm_read(0, legacy_seq, sizeof(legacy_seq), offsetof(legacy_meta_t, INIT_SEQ));
+            if(0 == memcmp(legacy_seq, LEGACY_INIT_SEQ_STR, sizeof(legacy_seq))) {
+                mount_rc = migrate();
+            }
+            else if(memcmp(hdr.INIT_SEQ, INIT_SEQ_STR, INIT_SEQ_FAMILY) && page_blank(0)) {
+                mount_rc = format();
+            }
+            else {
+                // another version of the directory layout, or not a tank at all
+                mount_rc = gpNvm_Result::DEVICE_FAIL;
+            }
+            if(mount_rc != gpNvm_Result::SUCCESS && mount_rc != gpNvm_Result::MEM_CORRUPTION) {
+                num_pages = 0;
+            }
+            return;
+        }
+
+        if(hdr.stage_page) {
+            // power was lost while converting from the legacy layout, after switching over
+            mount_rc = (hdr.num_entries > MAX_ATTRIBUTES || hdr.stage_page >= num_pages) ? gpNvm_Result::MEM_CORRUPTION : unstage();
+            if(mount_rc != gpNvm_Result::SUCCESS) {
+                num_pages = 0;
+                return;
+            }
+        }
+        if(hdr.num_entries > MAX_ATTRIBUTES || hdr.slab_floor > num_pages) {
+            // directory is beyond repair, start over with an empty one
+            mount_rc = gpNvm_Result::MEM_CORRUPTION;
+            hdr.num_entries = 0;
+            hdr.slab_floor = num_pages;
+            hdr.clean = 0;
+        }
+        for(size_t i = 0; i < hdr.num_entries && mount_rc == gpNvm_Result::SUCCESS; ) {
+            // all entries within a page in one read
+            size_t pos = entry_pos(i);
+            size_t count = (mem->get_page_size() - (pos % mem->get_page_size())) / sizeof(dir_entry_t);
+            if(count > hdr.num_entries - i) {
+                count = hdr.num_entries - i;
+            }
+            mount_rc = nvm_read(pos / mem->get_page_size(), &dir[i], count * sizeof(dir_entry_t), pos % mem->get_page_size());
+            i += count;
+        }
+        for(size_t i = 0; i < hdr.num_entries; i++) {
+            slot[dir[i].attrId] = i + 1;
+        }
+
+        // entries are validated lazily on first access, unless the last session did not shut down cleanly
+        if(!hdr.clean) {
+            verify();
+        }
+    }
+public:
+    /* @brief Constructor - mounts the tank on a device of its own
+     *
+     * @param[in] i_dev         - memory device
+     * @param[in] i_num_pages   - total number of pages
+     * @param[in] i_cache_size  - cache size in number of pages
+     * @param[in] i_with_compression - if values are compressed when set, by default turned off.
+     *                                 Compressed values are readable either way
+     */
+    ATTR_TANK(char *i_dev=(char*)ATTR_TANK_DEV, size_t i_num_pages=NUM_PAGES, size_t i_cache_size=CACHE_SIZE, bool i_with_compression=false) {
+        mem = new NVM(i_dev, PAGE_SIZE, i_num_pages, i_cache_size);
+        own_mem = true;
+        base_page = 0;
+        num_pages = mem->get_num_pages();
+        with_compression = i_with_compression;
+        mount();
+    }
+
+    /* @brief Constructor - mounts the tank as a namespace in a partition of a shared NVM.
+     * Each namespace has its own directory, while the NVM cache is shared as per the partition quotas
+     *
+     * @param[in] i_mem         - shared NVM, which must outlive the tank
+     * @param[in] i_part        - partition of the namespace, see NVM::add_partition
+     * @param[in] i_with_compression - if values are compressed when set, by default turned off
+     */
+    ATTR_TANK(NVM *i_mem, int i_part, bool i_with_compression=false) {
+        mem = i_mem;
+        own_mem = false;
+        base_page = 0;
+        num_pages = 0;
+        with_compression = i_with_compression;
+        const partition_t *part = mem->get_partition(i_part);
+        if(part) {
+            base_page = part->first_page;
+            num_pages = part->num_pages;
+        }
+        mount();
     }
 
     ~ATTR_TANK() {
-        delete mem;
+        if(dirty) {
+            hdr.clean = 1;
+            if(write_hdr() == gpNvm_Result::SUCCESS) {
+                mem->cache_flush();
+            }
+        }
+        if(own_mem) {
+            delete mem;
+        }
+    }
+
+    /* @brief Get the outcome of mounting the tank
+     *
+     * @return gpNvm_Result
+     */
+    gpNvm_Result get_mount_status(void) {
+        return mount_rc;
+    }
+
+    /* @brief Get the compression ratio over all values in the tank
+     *
+     * @return value bytes per stored byte, 1 if the tank is empty
+     */
+    double get_compression_ratio(void) {
+        size_t raw = 0, stored = 0;
+        for(size_t i = 0; i < hdr.num_entries; i++) {
+            raw += dir[i].len;
+            stored += dir[i].size;
+        }
+        return stored ? (double)raw / stored : 1;
     }
 
     gpNvm_Result set_attribute(gpNvm_AttrId attrId, UInt8 length, UInt8 *pValue) {
         gpNvm_Result rc = gpNvm_Result::SUCCESS;
 
         do {
+            if(!num_pages) {
+                // the tank did not mount
+                rc = mount_rc;
+                break;
+            }
+
+            size_t i = slot[attrId];
+            dir_entry_t e;
+            if(i == 0) {
+                memset(&e, 0, sizeof(e));
+                e.attrId = attrId;
+                e.flags = ATTR_INLINE;
+                i = hdr.num_entries + 1;
+            }
+            else {
+                e = dir[i-1];
+            }
+
+            // keep the compressed value only if it saves space
+            UInt8 packed[UINT8_MAX];
+            UInt8 *data = pValue;
+            size_t size = length;
+            if(with_compression && length > INLINE_MAX_SIZE) {
+                size_t packed_len = lz_compress(pValue, length, packed, length - 1);
+                if(packed_len) {
+                    data = packed;
+                    size = packed_len;
+                }
+            }
+
+            bool relocate = false;
+            if(size <= INLINE_MAX_SIZE) {
+                // the value is written along with its directory entry
+                e.flags = ATTR_INLINE;
+                e.cap = 0;
+                memcpy(e.value, data, size);
+            }
             // if attribute is previously set or not
-            // If the attribute is set with data longer than current one, we simply
-            // acquire another memory block and update the attribute there, abadoning
-            // the earlier one. This can be improved to reclaim such memory holes
-            if(meta.ATTR_MAP[attrId].len < length) {
-                // create a space
-                meta.ATTR_MAP[attrId].len = length;
-                meta.ATTR_MAP[attrId].page = meta.current_page;
-                meta.ATTR_MAP[attrId].offset = meta.current_offset;
-                meta.current_page = ((meta.current_page * mem->get_page_size()) + meta.current_offset + length) / mem->get_page_size();
-                meta.current_offset = ((meta.current_page * mem->get_page_size()) + meta.current_offset + length) % mem->get_page_size();
-                rc = mem->write(0, &meta, sizeof(meta), 0);
-                if(rc !=  gpNvm_Result::SUCCESS) {
+            // A value is overwritten in place only if that is atomic - same length within a single page.
+            // Otherwise it is moved to another memory block, so that a power loss leaves either of them
+            // intact. The earlier block is free once the entry is committed, and reused by later allocations
+            else if((e.flags & ATTR_INLINE) || e.len != length || e.size != size ||
+                    e.loc.offset + e.cap > mem->get_page_size() || check(attrId) == attr_state_t::CORRUPT) {
+                rc = allocate(e, size);
+                if(rc != gpNvm_Result::SUCCESS) {
                     break;
                 }
+                relocate = true;
+            }
+            e.len = length;
+            e.size = size;
+            e.flags &= ~ATTR_COMPRESSED;
+            if(data == packed) {
+                e.flags |= ATTR_COMPRESSED;
             }
 
-            rc = mem->write(meta.ATTR_MAP[attrId].page, pValue, length, meta.ATTR_MAP[attrId].offset);
-            if(rc != gpNvm_Result::SUCCESS) {
-                break;
+            // commit the value before the entry pointing at it
+            if(!(e.flags & ATTR_INLINE)) {
+                rc = nvm_write(e.loc.page, data, size, e.loc.offset);
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
+                rc = mem->cache_flush();
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
+            }
+
+            bool create = i > hdr.num_entries;
+            state[attrId] = attr_state_t::VALID;
+            if(create || relocate || memcmp(&e, &dir[i-1], sizeof(e))) {
+                // an entry in PAGE_0 is written along with the header in a single page write, leaving
+                // the directory consistent either way. One after PAGE_0 is written apart from it, so the
+                // first of those in a session clears the clean flag before
+                if(!dirty && entry_pos(i-1) >= mem->get_page_size()) {
+                    rc = mark_dirty();
+                    if(rc != gpNvm_Result::SUCCESS) {
+                        break;
+                    }
+                }
+                dir[i-1] = e;
+                rc = write_entry(i-1);
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
+            }
+            if(create) {
+                // create a directory entry
+                hdr.num_entries = i;
+                slot[attrId] = i;
+                relocate = true;
+            }
+            if(relocate) {
+                // and the entry before the header counting it, unless both are in PAGE_0
+                if(entry_pos(i-1) >= mem->get_page_size()) {
+                    rc = mem->cache_flush();
+                    if(rc != gpNvm_Result::SUCCESS) {
+                        break;
+                    }
+                }
+                rc = write_hdr();
+                if(rc != gpNvm_Result::SUCCESS) {
+                    break;
+                }
             }
             // TODO: create a separate task to commit - minimizing write cycles
             rc = mem->cache_flush();
@@ -385,8 +1271,34 @@ public:
     }
 
     gpNvm_Result get_attribute(gpNvm_AttrId attrId, UInt8 *length, UInt8 *pValue) {
-        *length = meta.ATTR_MAP[attrId].len;
-        return (gpNvm_Result)mem->read(meta.ATTR_MAP[attrId].page, pValue, *length, meta.ATTR_MAP[attrId].offset);
+        size_t i = slot[attrId];
+        *length = 0;
+        if(!num_pages) {
+            return mount_rc;
+        }
+        if(i == 0) {
+            return gpNvm_Result::SUCCESS;
+        }
+        if(check(attrId) == attr_state_t::CORRUPT) {
+            return gpNvm_Result::MEM_CORRUPTION;
+        }
+        const dir_entry_t &e = dir[i-1];
+        gpNvm_Result rc = gpNvm_Result::SUCCESS;
+        UInt8 packed[UINT8_MAX];
+        UInt8 *data = (e.flags & ATTR_COMPRESSED) ? packed : pValue;
+        if(e.flags & ATTR_INLINE) {
+            memcpy(data, e.value, e.size);
+        }
+        else {
+            rc = nvm_read(e.loc.page, data, e.size, e.loc.offset);
+        }
+        if(rc == gpNvm_Result::SUCCESS && data == packed && !lz_decompress(packed, e.size, pValue, e.len)) {
+            rc = gpNvm_Result::MEM_CORRUPTION;
+        }
+        if(rc == gpNvm_Result::SUCCESS) {
+            *length = e.len;
+        }
+        return rc;
     }
 
 };
@@ -0,0 +1,229 @@
+#include "app.h"
+#include <iostream>
+#include <chrono>
+#include <stdio.h>
+
+using namespace std;
+
+static char BENCH_DEV[] = "bench.dat";
+static char BENCH_NS_DEV[] = "bench_ns.dat";
+#define REPEAT 50
+#define VALUE_SIZE 200
+
+typedef chrono::high_resolution_clock bench_clock;
+
+static double elapsed_us(bench_clock::time_point start) {
+    return chrono::duration<double, micro>(bench_clock::now() - start).count();
+}
+
+static void reset_dev(size_t num_pages, const char *dev=BENCH_DEV) {
+    UInt8 zero[PAGE_SIZE] = {};
+    FILE *f = fopen(dev, "wb");
+    for(size_t p = 0; p < num_pages; p++) {
+        fwrite(zero, 1, sizeof(zero), f);
+    }
+    fclose(f);
+}
+
+static void set_clean(size_t num_pages, UInt8 clean) {
+    NVM mem(BENCH_DEV, PAGE_SIZE, num_pages, CACHE_SIZE);
+    dir_hdr_t hdr;
+    mem.read(0, &hdr, sizeof(hdr), 0);
+    hdr.clean = clean;
+    mem.write(0, &hdr, sizeof(hdr), 0);
+    mem.cache_flush();
+}
+
+/* @brief Mount time of a tank holding num_attrs attributes of VALUE_SIZE bytes
+ */
+static void bench_mount(size_t num_attrs) {
+    UInt8 value[VALUE_SIZE];
+    size_t num_pages = 2 * (4 + ((num_attrs * VALUE_SIZE) / (PAGE_SIZE - 1)));
+    reset_dev(num_pages);
+    {
+        ATTR_TANK tank(BENCH_DEV, num_pages, CACHE_SIZE);
+        for(size_t i = 0; i < num_attrs; i++) {
+            memset(value, (int)i, sizeof(value));
+            tank.set_attribute(i, sizeof(value), value);
+        }
+    }
+
+    // approximates the mount of the legacy layout - only the read of its fixed size map in one go
+    legacy_meta_t *legacy = new legacy_meta_t;
+    bench_clock::time_point start = bench_clock::now();
+    for(int r = 0; r < REPEAT; r++) {
+        NVM mem(BENCH_DEV, PAGE_SIZE, num_pages, CACHE_SIZE);
+        mem.read(0, legacy, sizeof(legacy_meta_t), 0);
+    }
+    double legacy_us = elapsed_us(start) / REPEAT;
+    delete legacy;
+
+    start = bench_clock::now();
+    for(int r = 0; r < REPEAT; r++) {
+        ATTR_TANK tank(BENCH_DEV, num_pages, CACHE_SIZE);
+    }
+    double clean_us = elapsed_us(start) / REPEAT;
+
+    double dirty_us = 0;
+    for(int r = 0; r < REPEAT; r++) {
+        set_clean(num_pages, 0);
+        start = bench_clock::now();
+        {
+            ATTR_TANK tank(BENCH_DEV, num_pages, CACHE_SIZE);
+        }
+        dirty_us += elapsed_us(start);
+    }
+    dirty_us /= REPEAT;
+
+    printf("%8zu %8zu %14.1f %14.1f %14.1f\n", num_attrs, num_pages, legacy_us, clean_us, dirty_us);
+}
+
+/* @brief Get throughput for num_attrs attributes of value_size bytes, accessed round robin
+ */
+static void bench_get(size_t num_attrs, size_t value_size) {
+    UInt8 value[256];
+    size_t num_pages = NUM_PAGES * 4;
+    reset_dev(num_pages);
+    ATTR_TANK tank(BENCH_DEV, num_pages, CACHE_SIZE);
+    for(size_t i = 0; i < num_attrs; i++) {
+        memset(value, (int)i, value_size);
+        tank.set_attribute(i, value_size, value);
+    }
+
+    NVM mem(BENCH_DEV, PAGE_SIZE, num_pages, CACHE_SIZE);
+    dir_hdr_t hdr;
+    mem.read(0, &hdr, sizeof(hdr), 0);
+    size_t dir_pages = 1 + ((sizeof(dir_hdr_t) + (MAX_ATTRIBUTES * sizeof(dir_entry_t)) - 1) / mem.get_page_size());
+    size_t value_pages = (mem.get_num_pages() - hdr.slab_floor) + (hdr.current_page - dir_pages) + (hdr.current_offset ? 1 : 0);
+
+    size_t gets = REPEAT * 1000;
+    UInt8 length;
+    bench_clock::time_point start = bench_clock::now();
+    for(size_t n = 0; n < gets; n++) {
+        tank.get_attribute((n * 7) % num_attrs, &length, value);
+    }
+    double us = elapsed_us(start);
+
+    printf("%8zu %8zu %12zu %14.0f\n", num_attrs, value_size, value_pages, gets / (us / 1e6));
+}
+
+/* @brief Space taken by num_attrs calibration tables and strings, with and without compression
+ */
+static void bench_compression(size_t num_attrs, bool with_compression) {
+    UInt8 value[VALUE_SIZE];
+    size_t num_pages = NUM_PAGES * 4;
+    reset_dev(num_pages);
+    ATTR_TANK tank(BENCH_DEV, num_pages, CACHE_SIZE, with_compression);
+    bench_clock::time_point start = bench_clock::now();
+    for(size_t i = 0; i < num_attrs; i++) {
+        if(i % 2) {
+            // piecewise linear table of 16 bit samples
+            uint16_t *table = (uint16_t*)value;
+            for(size_t s = 0; s < sizeof(value) / sizeof(*table); s++) {
+                table[s] = 1000 + (i * 10) + ((s / 10) * 25);
+            }
+        }
+        else {
+            memset(value, 0, sizeof(value));
+            snprintf((char*)value, sizeof(value), "sensor%zu.gain=1.0;sensor%zu.offset=0.0;sensor%zu.mode=auto;", i, i, i);
+        }
+        tank.set_attribute(i, sizeof(value), value);
+    }
+    double us = elapsed_us(start);
+
+    NVM mem(BENCH_DEV, PAGE_SIZE, num_pages, CACHE_SIZE);
+    dir_hdr_t hdr;
+    mem.read(0, &hdr, sizeof(hdr), 0);
+    size_t dir_pages = 1 + ((sizeof(dir_hdr_t) + (MAX_ATTRIBUTES * sizeof(dir_entry_t)) - 1) / mem.get_page_size());
+    size_t value_pages = (mem.get_num_pages() - hdr.slab_floor) + (hdr.current_page - dir_pages) + (hdr.current_offset ? 1 : 0);
+
+    printf("%8zu %12s %12zu %8.2f %14.1f\n", num_attrs, with_compression ? "on" : "off", value_pages,
+           tank.get_compression_ratio(), us / num_attrs);
+}
+
+#define NS_CACHE_BUDGET 4
+#define NS_PAGES 40
+#define NS_HOT_ATTRS 64
+#define NS_COLD_ATTRS 60
+
+/* @brief Hot namespace of small attributes next to a cold one being scanned
+ */
+static void ns_workload(ATTR_TANK &hot, ATTR_TANK &cold, const char *setup) {
+    UInt8 value[VALUE_SIZE], length;
+    for(size_t i = 0; i < NS_HOT_ATTRS; i++) {
+        memset(value, (int)i, 12);
+        hot.set_attribute(i, 12, value);
+    }
+    memset(value, 0xC0, sizeof(value));
+    for(size_t i = 0; i < NS_COLD_ATTRS; i++) {
+        cold.set_attribute(i, sizeof(value), value);
+    }
+
+    size_t gets = REPEAT * 1000;
+    bench_clock::time_point start = bench_clock::now();
+    for(size_t n = 0; n < gets; n++) {
+        if(n % 10) {
+            hot.get_attribute((n * 7) % NS_HOT_ATTRS, &length, value);
+        }
+        else {
+            cold.get_attribute((n / 10) % NS_COLD_ATTRS, &length, value);
+        }
+    }
+    double us = elapsed_us(start);
+    printf("%-28s %14.0f\n", setup, gets / (us / 1e6));
+}
+
+/* @brief Get throughput of hot and cold namespaces, with a cache budget of NS_CACHE_BUDGET pages
+ */
+static void bench_namespaces(void) {
+    {
+        // a device and a private cache per namespace
+        reset_dev(2 * NS_PAGES, BENCH_DEV);
+        reset_dev(2 * NS_PAGES, BENCH_NS_DEV);
+        ATTR_TANK hot(BENCH_DEV, 2 * NS_PAGES, NS_CACHE_BUDGET / 2);
+        ATTR_TANK cold(BENCH_NS_DEV, 2 * NS_PAGES, NS_CACHE_BUDGET / 2);
+        ns_workload(hot, cold, "separate devices");
+    }
+    size_t quotas[] = {0, 1};
+    const char *setups[] = {"shared, no quota", "shared, cold quota 1"};
+    for(int q = 0; q < 2; q++) {
+        reset_dev(4 * NS_PAGES, BENCH_DEV);
+        NVM mem(BENCH_DEV, PAGE_SIZE, 4 * NS_PAGES, NS_CACHE_BUDGET);
+        int hot_part, cold_part;
+        mem.add_partition(0, NS_PAGES, 0, hot_part);
+        mem.add_partition(NS_PAGES, NS_PAGES, quotas[q], cold_part);
+        ATTR_TANK hot(&mem, hot_part);
+        ATTR_TANK cold(&mem, cold_part);
+        ns_workload(hot, cold, setups[q]);
+    }
+}
+
+int main(void) {
+    cout << "Mount time in us, average of " << REPEAT << " mounts\n";
+    cout << "(full map* - approximation of the legacy mount, timing only the NVM read of its map)\n";
+    printf("%8s %8s %14s %14s %14s\n", "attrs", "pages", "full map*", "clean mount", "unclean mount");
+    bench_mount(16);
+    bench_mount(64);
+    bench_mount(128);
+    bench_mount(256);
+
+    cout << "\nGet throughput, " << CACHE_SIZE << " cache pages\n";
+    printf("%8s %8s %12s %14s\n", "attrs", "size", "value pages", "gets/s");
+    bench_get(128, 1);
+    bench_get(128, 4);
+    bench_get(128, 8);
+    bench_get(128, 16);
+    bench_get(128, 64);
+
+    cout << "\nCompression of " << VALUE_SIZE << " byte tables and strings\n";
+    printf("%8s %12s %12s %8s %14s\n", "attrs", "compression", "value pages", "ratio", "us per set");
+    bench_compression(64, false);
+    bench_compression(64, true);
+    bench_compression(128, false);
+    bench_compression(128, true);
+
+    cout << "\nHot and cold namespaces, " << NS_CACHE_BUDGET << " cache pages in total\n";
+    printf("%-28s %14s\n", "setup", "gets/s");
+    bench_namespaces();
+    return 0;
+}
@@ -0,0 +1,4 @@
+rm -rf bench.dat && \
+touch bench.dat && \
+g++ app.cpp bench.cpp -o bench -O2 --std=c++11 && ./bench && \
+rm -rf bench.dat bench_ns.dat bench
@@ -1,4 +1,4 @@
-rm -rf file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat && \
-touch file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat && \
+rm -rf file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat fast_mount.dat small_attr.dat compression.dat space_reuse.dat legacy.dat namespaces.dat && \
+touch file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat fast_mount.dat small_attr.dat compression.dat space_reuse.dat legacy.dat namespaces.dat && \
 g++ app.cpp test.cpp -o app --std=c++11 && ./app && \
-rm -rf file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat
+rm -rf file_test.dat ATTR_TANK.dat cache.dat mem_corruption.dat mem_correction.dat fast_mount.dat small_attr.dat compression.dat space_reuse.dat legacy.dat namespaces.dat
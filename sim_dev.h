@@ -0,0 +1,127 @@
+#pragma once
+#include "app.h"
+
+enum class sim_fault_t : UInt8 {
+    NONE,
+    TORN,     // only a random prefix of the data reaches the device
+    BIT_FLIP, // a random bit of the data is flipped on its way to the device
+    DROP      // the write is acknowledged but never reaches the device
+};
+
+/* SIM_DEV - RAM backed memory device for durability testing, injecting
+ * faults into writes and simulating power loss. Register it with
+ * _register_dev to plug it in under _read/_write
+ */
+class SIM_DEV : public NVM_DEV {
+private:
+    UInt8 *image;
+    size_t size;
+    size_t writes; // writes issued since construction
+    size_t fault_at; // write number the fault is injected at, 0 for none
+    sim_fault_t fault;
+    bool power_cut; // if power is lost at the faulty write
+    bool powered;
+    uint32_t seed;
+
+    // xorshift32, so that failing runs can be reproduced from the seed
+    uint32_t random(void) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+public:
+    /* @brief Constructor
+     *
+     * @param[in] i_size    - device size in bytes
+     * @param[in] i_seed    - seed for the random fault parameters, non zero
+     */
+    SIM_DEV(size_t i_size, uint32_t i_seed=1) {
+        size     = i_size;
+        image    = new UInt8[size];
+        writes   = 0;
+        fault_at = 0;
+        fault    = sim_fault_t::NONE;
+        power_cut = false;
+        powered  = true;
+        seed     = i_seed ? i_seed : 1;
+        memset(image, 0, size);
+    }
+
+    ~SIM_DEV() {
+        delete []image;
+    }
+
+    /* @brief Inject a fault into a future write
+     *
+     * @param[in] i_nth         - the fault hits the nth write from now, starting at 1
+     * @param[in] i_fault       - kind of fault
+     * @param[in] i_power_cut   - if power is lost at that write - it is then the last
+     *                            one to (partially) reach the device until power_on
+     */
+    void inject(size_t i_nth, sim_fault_t i_fault, bool i_power_cut=false) {
+        fault_at  = writes + i_nth;
+        fault     = i_fault;
+        power_cut = i_power_cut;
+    }
+
+    /* @brief Cancel a fault which has not hit yet */
+    void clear_fault(void) {
+        fault_at = 0;
+    }
+
+    /* @brief Restore power after a power cut, keeping the device contents */
+    void power_on(void) {
+        powered = true;
+    }
+
+    bool is_powered(void) {
+        return powered;
+    }
+
+    size_t get_writes(void) {
+        return writes;
+    }
+
+    gpNvm_Result read(size_t offset, size_t length, void *data) {
+        if(!powered || offset + length > size) {
+            return gpNvm_Result::DEVICE_FAIL;
+        }
+        memcpy(data, image + offset, length);
+        return gpNvm_Result::SUCCESS;
+    }
+
+    gpNvm_Result write(size_t offset, size_t length, void *data) {
+        if(!powered || offset + length > size) {
+            return gpNvm_Result::DEVICE_FAIL;
+        }
+        writes++;
+        if(writes != fault_at || !length) {
+            memcpy(image + offset, data, length);
+            return gpNvm_Result::SUCCESS;
+        }
+
+        switch(fault) {
+        case sim_fault_t::NONE:
+            memcpy(image + offset, data, length);
+            break;
+        case sim_fault_t::TORN:
+            memcpy(image + offset, data, random() % length);
+            break;
+        case sim_fault_t::BIT_FLIP: {
+            size_t bit = random() % (length * 8);
+            memcpy(image + offset, data, length);
+            image[offset + (bit / 8)] ^= (1 << (bit % 8));
+            break;
+        }
+        case sim_fault_t::DROP:
+            break;
+        }
+        fault_at = 0;
+        if(power_cut) {
+            powered = false;
+            return gpNvm_Result::DEVICE_FAIL;
+        }
+        return gpNvm_Result::SUCCESS;
+    }
+};
@@ -1,4 +1,5 @@
 #include "app.h"
+#include "sim_dev.h"
 #include <iostream>
 #include <string.h>
 
@@ -192,20 +193,49 @@ void test_cache10(void) {
     ASSERT("test_cache10:2", 0 == strcmp((const char*)data, (const char*)test_data))
 }
 
+void test_cache11(void) {
+    // cache shared by partitions - LRU replacement within quotas
+    NVM mem("cache.dat", 1024, 100, 4);
+    unsigned char test_data[5] = {};
+    int a = -1, b = -1, c = -1;
+    ASSERT("test_cache11:1", gpNvm_Result::SUCCESS == mem.add_partition(0, 10, 0, a))
+    ASSERT("test_cache11:2", gpNvm_Result::SUCCESS == mem.add_partition(10, 10, 1, b))
+    ASSERT("test_cache11:3", gpNvm_Result::OUT_OF_MEM == mem.add_partition(5, 10, 0, c))
+    ASSERT("test_cache11:4", gpNvm_Result::OUT_OF_MEM == mem.add_partition(40, 20, 0, c))
+
+    // a partition at its quota recycles its own pages
+    for(int p = 10; p < 16; p++) {
+        mem.read(p, &test_data, sizeof(test_data), 0);
+    }
+    ASSERT("test_cache11:5", 1 == mem.get_cache_pages(b))
+    for(int p = 0; p < 3; p++) {
+        mem.read(p, &test_data, sizeof(test_data), 0);
+    }
+    ASSERT("test_cache11:6", 3 == mem.get_cache_pages(a) && 1 == mem.get_cache_pages(b))
+
+    // cold pages do not stay pinned
+    mem.read(3, &test_data, sizeof(test_data), 0);
+    ASSERT("test_cache11:7", 4 == mem.get_cache_pages(a) && 0 == mem.get_cache_pages(b))
+
+    // while a partition below its quota takes the least recently used page
+    mem.read(0, &test_data, sizeof(test_data), 0);
+    mem.read(16, &test_data, sizeof(test_data), 0);
+    ASSERT("test_cache11:8", 3 == mem.get_cache_pages(a) && 1 == mem.get_cache_pages(b))
+    ASSERT("test_cache11:9", 0 == mem.get_cache_pages(c))
+}
+
 void test_attr_1(void) {
     ATTR_TANK tank;
 
-    meta_t meta, test_meta;
-    meta.current_page = 1 + (sizeof(meta_t) / PAGE_SIZE);
-    meta.current_offset = 0;
-    strcpy((char*)meta.INIT_SEQ, "CODE");
-    memset(meta.ATTR_MAP, 0, sizeof(meta.ATTR_MAP));
+    dir_hdr_t test_hdr;
+    size_t dir_pages = 1 + ((sizeof(dir_hdr_t) + (MAX_ATTRIBUTES * sizeof(dir_entry_t)) - 1) / (PAGE_SIZE - 1));
 
-    NVM mem("ATTR_TANK.dat", 1024, 10, 2);
-    mem.read(0, &test_meta, sizeof(test_meta), 0);
+    NVM mem("ATTR_TANK.dat", PAGE_SIZE, NUM_PAGES, 2);
+    mem.read(0, &test_hdr, sizeof(test_hdr), 0);
 
-    ASSERT("test_attr_1:1", 0 == memcmp(&meta.INIT_SEQ, &test_meta.INIT_SEQ, sizeof(meta.INIT_SEQ)))
-    ASSERT("test_attr_1:2", 0 == memcmp(&meta.current_page, &test_meta.current_page, sizeof(meta.current_page)))
+    ASSERT("test_attr_1:1", 0 == memcmp(INIT_SEQ_STR, &test_hdr.INIT_SEQ, sizeof(test_hdr.INIT_SEQ)))
+    ASSERT("test_attr_1:2", dir_pages == test_hdr.current_page)
+    ASSERT("test_attr_1:3", 1 == test_hdr.clean)
 }
 
 void test_attr_2(void) {
@@ -260,6 +290,469 @@ void test_attr_4(void) {
     ASSERT("test_attr_4:4", length == sizeof(data1))
 }
 
+void test_attr_5(void) {
+    // clean shutdown flag
+    char *file = "fast_mount.dat";
+    dir_hdr_t test_hdr;
+    unsigned char data = 0x5A;
+    {
+        ATTR_TANK tank(file);
+        tank.set_attribute(5, sizeof(data), &data);
+
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+        // an update of PAGE_0 only leaves the directory consistent, without clearing the flag
+        ASSERT("test_attr_5:1", 1 == test_hdr.clean)
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+    ASSERT("test_attr_5:2", 1 == test_hdr.clean)
+    ASSERT("test_attr_5:3", 1 == test_hdr.num_entries)
+}
+
+void test_attr_6(void) {
+    // lazy validation of a corrupt directory entry
+    char *file = "fast_mount.dat";
+    unsigned long int data = 0x6B6B6B6B6B, test_data = 0;
+    unsigned char test_data5 = 0, length = 0;
+    {
+        ATTR_TANK tank(file);
+        tank.set_attribute(6, sizeof(data), (UInt8*)&data);
+    }
+    {
+        // point entry of attribute 6 (index 1) beyond the tank
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        dir_entry_t e;
+        mem.read(0, &e, sizeof(e), sizeof(dir_hdr_t) + sizeof(e));
+        e.loc.page = NUM_PAGES;
+        mem.write(0, &e, sizeof(e), sizeof(dir_hdr_t) + sizeof(e));
+        mem.cache_flush();
+    }
+    ATTR_TANK tank(file);
+    ASSERT("test_attr_6:1", gpNvm_Result::SUCCESS == tank.get_mount_status())
+    ASSERT("test_attr_6:2", gpNvm_Result::MEM_CORRUPTION == tank.get_attribute(6, &length, (UInt8*)&test_data))
+    ASSERT("test_attr_6:3", gpNvm_Result::SUCCESS == tank.get_attribute(5, &length, &test_data5))
+    ASSERT("test_attr_6:4", 0x5A == test_data5)
+
+    // setting it again moves it to a fresh location
+    tank.set_attribute(6, sizeof(data), (UInt8*)&data);
+    ASSERT("test_attr_6:5", gpNvm_Result::SUCCESS == tank.get_attribute(6, &length, (UInt8*)&test_data))
+    ASSERT("test_attr_6:6", data == test_data)
+}
+
+void test_attr_7(void) {
+    // unclean shutdown - header missed the last allocation
+    char *file = "fast_mount.dat";
+    unsigned char data[64], test_data[64] = {};
+    unsigned char length = 0;
+    dir_hdr_t hdr;
+    memset(data, 0x7C, sizeof(data));
+    {
+        ATTR_TANK tank(file);
+        tank.set_attribute(7, sizeof(data), data);
+    }
+    {
+        // roll back the allocation tail and drop the clean flag
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        hdr.current_offset -= sizeof(data);
+        hdr.clean = 0;
+        mem.write(0, &hdr, sizeof(hdr), 0);
+        mem.cache_flush();
+    }
+    {
+        ATTR_TANK tank(file);
+        ASSERT("test_attr_7:1", gpNvm_Result::SUCCESS == tank.get_attribute(7, &length, test_data))
+        ASSERT("test_attr_7:2", 0 == memcmp(data, test_data, sizeof(data)))
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    dir_hdr_t test_hdr;
+    mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+    ASSERT("test_attr_7:3", hdr.current_offset + sizeof(data) == test_hdr.current_offset)
+}
+
+void test_attr_8(void) {
+    // small values are stored inline in the directory
+    char *file = "small_attr.dat";
+    unsigned int data = 0xCAFE, test_data = 0;
+    unsigned char length = 0;
+    dir_hdr_t hdr, test_hdr;
+    {
+        ATTR_TANK tank(file);
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        tank.set_attribute(20, sizeof(data), (UInt8*)&data);
+    }
+    {
+        ATTR_TANK tank(file);
+        ASSERT("test_attr_8:1", gpNvm_Result::SUCCESS == tank.get_attribute(20, &length, (UInt8*)&test_data))
+        ASSERT("test_attr_8:2", data == test_data && length == sizeof(data))
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+    ASSERT("test_attr_8:3", hdr.current_page == test_hdr.current_page && hdr.current_offset == test_hdr.current_offset)
+    ASSERT("test_attr_8:4", hdr.slab_floor == test_hdr.slab_floor)
+}
+
+void test_attr_9(void) {
+    // values of the same size class share a slab page
+    char *file = "small_attr.dat";
+    unsigned long int data = 0x1122334455667788, test_data = 0;
+    unsigned char big[20], test_big[20] = {}, length = 0;
+    memset(big, 0x9D, sizeof(big));
+    {
+        ATTR_TANK tank(file);
+        for(int i = 30; i < 40; i++) {
+            data++;
+            tank.set_attribute(i, sizeof(data), (UInt8*)&data);
+        }
+        // grows into the next size class
+        tank.set_attribute(39, sizeof(big), big);
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    dir_hdr_t hdr;
+    mem.read(0, &hdr, sizeof(hdr), 0);
+    ASSERT("test_attr_9:1", NUM_PAGES / 2 - 2 == hdr.slab_floor)
+    dir_entry_t e;
+    mem.read(0, &e, sizeof(e), sizeof(dir_hdr_t) + (10 * sizeof(e)));
+    ASSERT("test_attr_9:2", 39 == e.attrId && NUM_PAGES / 2 - 2 == e.loc.page && 32 == e.cap)
+
+    ATTR_TANK tank(file);
+    tank.get_attribute(38, &length, (UInt8*)&test_data);
+    ASSERT("test_attr_9:3", data - 1 == test_data && length == sizeof(data))
+    tank.get_attribute(39, &length, test_big);
+    ASSERT("test_attr_9:4", 0 == memcmp(big, test_big, sizeof(big)) && length == sizeof(big))
+
+    // shrinking reports the new length
+    tank.set_attribute(39, 12, big);
+    tank.get_attribute(39, &length, test_big);
+    ASSERT("test_attr_9:5", 12 == length)
+
+    // the slot left by attribute 39 in the first slab page is reused
+    tank.set_attribute(40, sizeof(data), (UInt8*)&data);
+    NVM test_mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    test_mem.read(0, &e, sizeof(e), sizeof(dir_hdr_t) + (11 * sizeof(e)));
+    ASSERT("test_attr_9:6", 40 == e.attrId && NUM_PAGES / 2 - 1 == e.loc.page && 9 * sizeof(data) == e.loc.offset)
+}
+
+void test_attr_10(void) {
+    // optional compression of values
+    char *file = "compression.dat";
+    unsigned char table[200], text[] = "calibration calibration calibration", random[64];
+    unsigned char test_data[UINT8_MAX] = {}, length = 0;
+    for(int i = 0; i < sizeof(table); i++) {
+        table[i] = i / 8;
+    }
+    for(int i = 0; i < sizeof(random); i++) {
+        random[i] = (i * 151 + 17) ^ (i >> 1);
+    }
+    {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, true);
+        tank.set_attribute(1, sizeof(table), table);
+        tank.set_attribute(2, sizeof(text), text);
+        tank.set_attribute(3, sizeof(random), random);
+        ASSERT("test_attr_10:1", tank.get_compression_ratio() > 1.5)
+    }
+    {
+        // compressed values are readable without compression turned on
+        ATTR_TANK tank(file);
+        tank.get_attribute(1, &length, test_data);
+        ASSERT("test_attr_10:2", sizeof(table) == length && 0 == memcmp(table, test_data, sizeof(table)))
+        tank.get_attribute(2, &length, test_data);
+        ASSERT("test_attr_10:3", sizeof(text) == length && 0 == memcmp(text, test_data, sizeof(text)))
+        tank.get_attribute(3, &length, test_data);
+        ASSERT("test_attr_10:4", sizeof(random) == length && 0 == memcmp(random, test_data, sizeof(random)))
+
+        // and overwritten uncompressed
+        tank.set_attribute(2, sizeof(text), text);
+    }
+    ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, true);
+    tank.get_attribute(2, &length, test_data);
+    ASSERT("test_attr_10:5", sizeof(text) == length && 0 == memcmp(text, test_data, sizeof(text)))
+}
+
+void test_ns_1(void) {
+    // independent namespaces sharing one NVM
+    char *file = "namespaces.dat";
+    NVM mem(file, PAGE_SIZE, 2 * 42, 4);
+    int a = -1, b = -1;
+    mem.add_partition(0, 20, 0, a);
+    mem.add_partition(20, 20, 2, b);
+    unsigned char data_a[16], data_b[40], big[200], test_data[UINT8_MAX] = {}, length = 0;
+    memset(data_a, 0xA1, sizeof(data_a));
+    memset(data_b, 0xB2, sizeof(data_b));
+    memset(big, 0xC3, sizeof(big));
+    {
+        ATTR_TANK tank_a(&mem, a), tank_b(&mem, b);
+        ASSERT("test_ns_1:1", gpNvm_Result::SUCCESS == tank_a.get_mount_status() && gpNvm_Result::SUCCESS == tank_b.get_mount_status())
+        tank_a.set_attribute(1, sizeof(data_a), data_a);
+        tank_b.set_attribute(1, sizeof(data_b), data_b);
+
+        // filling up a namespace leaves the other intact
+        gpNvm_Result rc = gpNvm_Result::SUCCESS;
+        for(int i = 2; i < MAX_ATTRIBUTES && rc == gpNvm_Result::SUCCESS; i++) {
+            rc = tank_a.set_attribute(i, sizeof(big), big);
+        }
+        ASSERT("test_ns_1:2", gpNvm_Result::OUT_OF_MEM == rc)
+    }
+    {
+        ATTR_TANK tank_a(&mem, a), tank_b(&mem, b);
+        tank_a.get_attribute(1, &length, test_data);
+        ASSERT("test_ns_1:3", sizeof(data_a) == length && 0 == memcmp(data_a, test_data, sizeof(data_a)))
+        tank_b.get_attribute(1, &length, test_data);
+        ASSERT("test_ns_1:4", sizeof(data_b) == length && 0 == memcmp(data_b, test_data, sizeof(data_b)))
+        tank_a.get_attribute(2, &length, test_data);
+        ASSERT("test_ns_1:5", sizeof(big) == length && 0 == memcmp(big, test_data, sizeof(big)))
+        ASSERT("test_ns_1:6", mem.get_cache_pages(b) <= 2)
+    }
+
+    // too small or unknown partitions do not mount
+    int c = -1;
+    ASSERT("test_ns_1:7", gpNvm_Result::SUCCESS == mem.add_partition(40, 2, 0, c))
+    ATTR_TANK tank_c(&mem, c), tank_d(&mem, 7);
+    ASSERT("test_ns_1:8", gpNvm_Result::OUT_OF_MEM == tank_c.get_mount_status())
+    ASSERT("test_ns_1:9", gpNvm_Result::OUT_OF_MEM == tank_d.set_attribute(1, sizeof(data_a), data_a))
+}
+
+#define REUSE_SETS 5000
+
+void test_attr_11(void) {
+    // updates changing the size of a value reuse the space they leave behind
+    char *file = "space_reuse.dat";
+    unsigned char data[12], table[200], test_data[UINT8_MAX] = {}, length = 0;
+    gpNvm_Result rc = gpNvm_Result::SUCCESS;
+    size_t n;
+    {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, true);
+        for(n = 0; n < REUSE_SETS && rc == gpNvm_Result::SUCCESS; n++) {
+            for(int i = 0; i < sizeof(data); i++) {
+                data[i] = (i * 37) + n;
+            }
+            rc = tank.set_attribute(1, 10 + (n % 3), data);
+        }
+        ASSERT("test_attr_11:1", gpNvm_Result::SUCCESS == rc)
+
+        // compressed size changes with the contents
+        for(n = 0; n < REUSE_SETS && rc == gpNvm_Result::SUCCESS; n++) {
+            for(int i = 0; i < sizeof(table); i++) {
+                table[i] = (i / (1 + (n % 7))) + n;
+            }
+            rc = tank.set_attribute(2, sizeof(table), table);
+        }
+        ASSERT("test_attr_11:2", gpNvm_Result::SUCCESS == rc)
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    dir_hdr_t hdr;
+    size_t dir_pages = 1 + ((sizeof(dir_hdr_t) + (MAX_ATTRIBUTES * sizeof(dir_entry_t)) - 1) / PAGE_SIZE);
+    mem.read(0, &hdr, sizeof(hdr), 0);
+    ASSERT("test_attr_11:3", NUM_PAGES / 2 - 1 == hdr.slab_floor && dir_pages == hdr.current_page)
+
+    ATTR_TANK tank(file);
+    tank.get_attribute(1, &length, test_data);
+    ASSERT("test_attr_11:4", 10 + ((REUSE_SETS - 1) % 3) == length && 0 == memcmp(data, test_data, length))
+    tank.get_attribute(2, &length, test_data);
+    ASSERT("test_attr_11:5", sizeof(table) == length && 0 == memcmp(table, test_data, length))
+}
+
+/* @brief Write a tank in the legacy layout - attribute 7 of 1 byte, 9 of 40 bytes
+ * and count attributes of size bytes from attribute 10 on
+ */
+void legacy_tank(char *file, int count, size_t size=200) {
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    legacy_meta_t meta;
+    unsigned char data7 = 0x42, data9[40], big[UINT8_MAX];
+    memset(&meta, 0, sizeof(meta));
+    memset(data9, 0x99, sizeof(data9));
+    strcpy((char*)meta.INIT_SEQ, LEGACY_INIT_SEQ_STR);
+    size_t pos = (1 + (sizeof(meta) / mem.get_page_size())) * mem.get_page_size();
+    for(int a = 7; a < 10 + count; a++) {
+        meta.ATTR_MAP[a].len = (a == 7) ? sizeof(data7) : (a == 9) ? sizeof(data9) : (a < 10) ? 0 : size;
+        meta.ATTR_MAP[a].page = pos / mem.get_page_size();
+        meta.ATTR_MAP[a].offset = pos % mem.get_page_size();
+        memset(big, a, size);
+        mem.write(meta.ATTR_MAP[a].page, (a == 7) ? &data7 : (a == 9) ? data9 : big, meta.ATTR_MAP[a].len, meta.ATTR_MAP[a].offset);
+        pos += meta.ATTR_MAP[a].len;
+    }
+    meta.current_page = pos / mem.get_page_size();
+    meta.current_offset = pos % mem.get_page_size();
+    mem.write(0, &meta, sizeof(meta), 0);
+    mem.cache_flush();
+}
+
+/* @brief Check that a tank holds the attributes written by legacy_tank */
+bool legacy_check(ATTR_TANK &tank, int count, size_t size=200) {
+    unsigned char data9[40], big[UINT8_MAX], test_data[UINT8_MAX] = {}, length = 0;
+    memset(data9, 0x99, sizeof(data9));
+    bool ok = gpNvm_Result::SUCCESS == tank.get_attribute(7, &length, test_data) && 1 == length && 0x42 == test_data[0];
+    ok = ok && gpNvm_Result::SUCCESS == tank.get_attribute(9, &length, test_data);
+    ok = ok && sizeof(data9) == length && 0 == memcmp(data9, test_data, sizeof(data9));
+    for(int a = 10; a < 10 + count; a++) {
+        memset(big, a, size);
+        ok = ok && gpNvm_Result::SUCCESS == tank.get_attribute(a, &length, test_data);
+        ok = ok && size == length && 0 == memcmp(big, test_data, size);
+    }
+    return ok;
+}
+
+void test_attr_12(void) {
+    // a tank in the legacy layout is converted on mount
+    char *file = "legacy.dat";
+    unsigned char data9[40], test_data[UINT8_MAX] = {}, length = 0;
+    memset(data9, 0x99, sizeof(data9));
+    int counts[] = {0, 60, 100};
+    size_t sizes[] = {200, 200, 20};
+    for(int c = 0; c < 3; c++) {
+        // with 100 attributes, the entries after PAGE_0 are staged
+        legacy_tank(file, counts[c], sizes[c]);
+        {
+            ATTR_TANK tank(file);
+            ASSERT("test_attr_12:1", gpNvm_Result::SUCCESS == tank.get_mount_status())
+        }
+        ATTR_TANK tank(file);
+        ASSERT("test_attr_12:2", legacy_check(tank, counts[c], sizes[c]))
+        // and the legacy space is reused
+        for(int a = 10; a < 10 + counts[c]; a++) {
+            tank.set_attribute(a, sizeof(data9), data9);
+        }
+        ASSERT("test_attr_12:3", gpNvm_Result::SUCCESS == tank.set_attribute(200, sizeof(data9), data9))
+    }
+    {
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        dir_hdr_t hdr;
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        ASSERT("test_attr_12:4", 0 == hdr.stage_page)
+    }
+
+    // a directory of another version is not formatted
+    dir_hdr_t hdr;
+    {
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        memcpy(hdr.INIT_SEQ, "CDR4", sizeof(hdr.INIT_SEQ));
+        mem.write(0, &hdr, sizeof(hdr), 0);
+        mem.cache_flush();
+    }
+    {
+        ATTR_TANK tank(file);
+        ASSERT("test_attr_12:5", gpNvm_Result::DEVICE_FAIL == tank.get_mount_status())
+        ASSERT("test_attr_12:6", gpNvm_Result::DEVICE_FAIL == tank.set_attribute(7, sizeof(data9), data9))
+        ASSERT("test_attr_12:7", gpNvm_Result::DEVICE_FAIL == tank.get_attribute(7, &length, test_data) && 0 == length)
+    }
+    {
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        dir_hdr_t test_hdr;
+        mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+        ASSERT("test_attr_12:8", 0 == memcmp(&hdr, &test_hdr, sizeof(hdr)))
+
+        // neither is a PAGE_0 which is not blank
+        memcpy(hdr.INIT_SEQ, "JUNK", sizeof(hdr.INIT_SEQ));
+        mem.write(0, &hdr, sizeof(hdr), 0);
+        mem.cache_flush();
+    }
+    {
+        ATTR_TANK tank(file);
+        ASSERT("test_attr_12:9", gpNvm_Result::DEVICE_FAIL == tank.get_mount_status())
+    }
+    NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+    dir_hdr_t test_hdr;
+    mem.read(0, &test_hdr, sizeof(test_hdr), 0);
+    ASSERT("test_attr_12:10", 0 == memcmp(&hdr, &test_hdr, sizeof(hdr)))
+}
+
+void test_attr_13(void) {
+    // device writes per update - each page is written twice, to the primary and the mirror
+    char *file = "wear.dat";
+    SIM_DEV dev(NUM_PAGES * PAGE_SIZE);
+    _register_dev(file, &dev);
+    unsigned char data = 0xD1, big[20];
+    memset(big, 0xD2, sizeof(big));
+    dir_hdr_t hdr;
+    size_t writes;
+    {
+        ATTR_TANK tank(file);
+        writes = dev.get_writes();
+        // an entry in PAGE_0 is committed along with the header in a single page write
+        tank.set_attribute(1, sizeof(data), &data);
+        ASSERT("test_attr_13:1", writes + 2 == dev.get_writes())
+        tank.set_attribute(2, sizeof(data), &data);
+        ASSERT("test_attr_13:2", writes + 4 == dev.get_writes())
+
+        // a value of the same size is changed in place, leaving the directory as it is
+        tank.set_attribute(3, sizeof(big), big);
+        writes = dev.get_writes();
+        big[0]++;
+        tank.set_attribute(3, sizeof(big), big);
+        ASSERT("test_attr_13:3", writes + 2 == dev.get_writes())
+        writes = dev.get_writes();
+    }
+    {
+        // which leaves the clean flag set, with nothing to write on shutdown
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        ASSERT("test_attr_13:4", 1 == hdr.clean && writes == dev.get_writes())
+    }
+    {
+        // the first entry after PAGE_0 clears the clean flag until shutdown
+        ATTR_TANK tank(file);
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        size_t page0_entries = (mem.get_page_size() - sizeof(dir_hdr_t)) / sizeof(dir_entry_t);
+        for(size_t a = 10; a < 10 + page0_entries - 3; a++) {
+            tank.set_attribute(a, sizeof(data), &data);
+        }
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        ASSERT("test_attr_13:5", 1 == hdr.clean && page0_entries == hdr.num_entries)
+        tank.set_attribute(200, sizeof(data), &data);
+        NVM test_mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        test_mem.read(0, &hdr, sizeof(hdr), 0);
+        ASSERT("test_attr_13:6", 0 == hdr.clean)
+    }
+    {
+        NVM mem(file, PAGE_SIZE, NUM_PAGES, 2);
+        mem.read(0, &hdr, sizeof(hdr), 0);
+        ASSERT("test_attr_13:7", 1 == hdr.clean)
+    }
+    _register_dev(file, NULL);
+}
+
+void test_attr_14(void) {
+    // the wrappers mount the default tank on each call - an update costs one page write, twice
+    // with the mirror, and they see updates made through any other tank
+    SIM_DEV dev(NUM_PAGES * PAGE_SIZE);
+    _register_dev(ATTR_TANK_DEV, &dev);
+    unsigned char data1 = 0xB1, data2 = 0xB2, data3 = 0xB3, test_data = 0, length = 0;
+    gpNvm_SetAttribute(41, sizeof(data1), &data1);
+    size_t writes = dev.get_writes();
+    gpNvm_SetAttribute(41, sizeof(data3), &data3);
+    ASSERT("test_attr_14:1", writes + 2 == dev.get_writes())
+    {
+        ATTR_TANK tank;
+        tank.set_attribute(42, sizeof(data2), &data2);
+    }
+    gpNvm_GetAttribute(42, &length, &test_data);
+    ASSERT("test_attr_14:2", data2 == test_data && sizeof(data2) == length)
+    gpNvm_SetAttribute(43, sizeof(data3), &data3);
+    ATTR_TANK tank;
+    tank.get_attribute(42, &length, &test_data);
+    ASSERT("test_attr_14:3", data2 == test_data && sizeof(data2) == length)
+    _register_dev(ATTR_TANK_DEV, NULL);
+}
+
+void test_lz_1(void) {
+    unsigned char data[UINT8_MAX], packed[UINT8_MAX], test_data[UINT8_MAX];
+    for(int i = 0; i < sizeof(data); i++) {
+        data[i] = (i % 50 < 25) ? 'A' : i;
+    }
+    size_t packed_len = lz_compress(data, sizeof(data), packed, sizeof(packed));
+    ASSERT("test_lz_1:1", packed_len > 0 && packed_len < sizeof(data))
+    ASSERT("test_lz_1:2", lz_decompress(packed, packed_len, test_data, sizeof(data)))
+    ASSERT("test_lz_1:3", 0 == memcmp(data, test_data, sizeof(data)))
+
+    // does not fit the destination
+    ASSERT("test_lz_1:4", 0 == lz_compress(data, sizeof(data), packed, 10))
+    // truncated input
+    ASSERT("test_lz_1:5", !lz_decompress(packed, packed_len / 2, test_data, sizeof(data)))
+}
+
 void test_mem_1(void) {
     char *file = "mem_corruption.dat";
     NVM mem(file, 1024, 10, 2, false);
@@ -276,7 +769,9 @@ void test_mem_1(void) {
     // corrupt the mem
     data[0] = 'B';
     _write(file, 0, sizeof(data[0]), &data[0]);
-    ASSERT("test_mem_1:2", gpNvm_Result::MEM_CORRUPTION == mem.read(0, &test_data, sizeof(test_data), 0))
+    // read it from the device, as the page is still in cache
+    NVM test_mem(file, 1024, 10, 2, false);
+    ASSERT("test_mem_1:2", gpNvm_Result::MEM_CORRUPTION == test_mem.read(0, &test_data, sizeof(test_data), 0))
 }
 
 void test_mem_2(void) {
@@ -294,12 +789,246 @@ void test_mem_2(void) {
     data[0] = 'B';
     _write(file, 0, sizeof(data[0]), &data[0]);
 
-    // corruption should be fixed
+    // corruption should be fixed, when read from the device as the page is still in cache
     memset(&test_data, 0, sizeof(test_data));
-    mem.read(0, &test_data, sizeof(test_data), 0);
+    NVM test_mem(file, 1024, 10, 2);
+    test_mem.read(0, &test_data, sizeof(test_data), 0);
     ASSERT("test_mem_2:2", 0 == strcmp((const char*)test_data, "CODE"))
 }
 
+void test_sim_1(void) {
+    // faults injected under NVM
+    char *file = "sim.dat";
+    SIM_DEV dev(4 * 1024);
+    _register_dev(file, &dev);
+    unsigned char data1[] = "AAAA", data2[] = "BBBB", test_data[5] = {};
+    {
+        NVM mem(file, 1024, 4, 1);
+        mem.write(0, &data1, sizeof(data1), 0);
+        mem.cache_flush();
+        // bit flip on the primary copy of page 1
+        dev.inject(1, sim_fault_t::BIT_FLIP);
+        mem.write(1, &data2, sizeof(data2), 0);
+        mem.cache_flush();
+    }
+    {
+        NVM mem(file, 1024, 4, 1);
+        ASSERT("test_sim_1:1", gpNvm_Result::SUCCESS == mem.read(1, &test_data, sizeof(test_data), 0))
+        ASSERT("test_sim_1:2", 0 == strcmp((const char*)test_data, "BBBB"))
+        // repaired copy must not land on the page swapped out
+        mem.read(0, &test_data, sizeof(test_data), 0);
+        ASSERT("test_sim_1:3", 0 == strcmp((const char*)test_data, "AAAA"))
+    }
+    {
+        NVM mem(file, 1024, 4, 1, false);
+        dev.inject(1, sim_fault_t::TORN, true);
+        mem.write(2, &data2, sizeof(data2), 0);
+        ASSERT("test_sim_1:4", gpNvm_Result::DEVICE_FAIL == mem.cache_flush())
+        ASSERT("test_sim_1:5", gpNvm_Result::DEVICE_FAIL == mem.read(3, &test_data, sizeof(test_data), 0))
+    }
+    dev.clear_fault();
+    dev.power_on();
+    NVM mem(file, 1024, 4, 1, false);
+    ASSERT("test_sim_1:6", gpNvm_Result::MEM_CORRUPTION == mem.read(2, &test_data, sizeof(test_data), 0))
+    _register_dev(file, NULL);
+}
+
+#define CRASH_RUNS 100
+#define CRASH_ATTRS 12
+#define CRASH_SETS 40
+
+/* @brief Value of an attribute for a given version, of varying size so that
+ * inline, slab and extent placement all get exercised
+ */
+static UInt8 crash_value(UInt8 attrId, int version, UInt8 *value) {
+    UInt8 len = 1 + (((attrId * 37) + (version * 11)) % 90);
+    for(int i = 0; i < len; i++) {
+        value[i] = attrId + version + (i / 3);
+    }
+    return len;
+}
+
+/* @brief Check that an attribute holds one of two versions, 0 for not set */
+static bool crash_check(ATTR_TANK &tank, UInt8 attrId, int v1, int v2) {
+    UInt8 value[UINT8_MAX], expected[UINT8_MAX], length = 0;
+    if(gpNvm_Result::SUCCESS != tank.get_attribute(attrId, &length, value)) {
+        return false;
+    }
+    int versions[] = {v1, v2};
+    for(int v = 0; v < 2; v++) {
+        if(versions[v] == 0) {
+            if(length == 0) {
+                return true;
+            }
+            continue;
+        }
+        UInt8 len = crash_value(attrId, versions[v], expected);
+        if(len == length && 0 == memcmp(value, expected, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* @brief One run of the crash-recovery harness - random sets with a fault injected
+ * at a random write, then remount and check the tank invariants
+ *
+ * @param[in] seed      - seed of the run
+ * @param[in] fault     - kind of fault
+ * @param[in] power_cut - if power is lost at the faulty write
+ * @param[in] strict    - each attribute must hold its last acknowledged value, or the
+ *                        one being set when power was lost; otherwise gets may only fail
+ *                        with MEM_CORRUPTION, as the fault can go undetected
+ *
+ * @return true if all invariants held
+ */
+static bool crash_run(uint32_t seed, sim_fault_t fault, bool power_cut, bool strict) {
+    char *file = "sim.dat";
+    SIM_DEV dev(NUM_PAGES * PAGE_SIZE, seed);
+    _register_dev(file, &dev);
+    int acked[CRASH_ATTRS] = {}, inflight[CRASH_ATTRS] = {};
+    UInt8 value[UINT8_MAX], length;
+    bool with_compression = seed % 2;
+    bool ok = true;
+    uint32_t rnd = seed;
+
+    {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, with_compression);
+        rnd = (rnd * 1103515245) + 12345;
+        dev.inject(1 + ((rnd >> 8) % 300), fault, power_cut);
+        for(int s = 1; s <= CRASH_SETS && dev.is_powered(); s++) {
+            rnd = (rnd * 1103515245) + 12345;
+            UInt8 attrId = (rnd >> 8) % CRASH_ATTRS;
+            inflight[attrId] = s;
+            if(gpNvm_Result::SUCCESS == tank.set_attribute(attrId, crash_value(attrId, s, value), value)) {
+                acked[attrId] = s;
+            }
+        }
+    }
+    dev.clear_fault();
+    dev.power_on();
+
+    // first remount verifies after a power cut, the second one is clean
+    for(int remount = 0; remount < 2; remount++) {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, with_compression);
+        ok = ok && (!strict || gpNvm_Result::SUCCESS == tank.get_mount_status());
+        for(int a = 0; a < CRASH_ATTRS; a++) {
+            if(strict) {
+                ok = ok && crash_check(tank, a, acked[a], inflight[a]);
+            }
+            else {
+                gpNvm_Result rc = tank.get_attribute(a, &length, value);
+                ok = ok && (gpNvm_Result::SUCCESS == rc || gpNvm_Result::MEM_CORRUPTION == rc);
+            }
+        }
+    }
+
+    // the recovered tank takes updates
+    {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, with_compression);
+        for(int a = 0; a < CRASH_ATTRS; a++) {
+            ok = ok && gpNvm_Result::SUCCESS == tank.set_attribute(a, crash_value(a, 100, value), value);
+        }
+    }
+    {
+        ATTR_TANK tank(file, NUM_PAGES, CACHE_SIZE, with_compression);
+        for(int a = 0; a < CRASH_ATTRS; a++) {
+            ok = ok && crash_check(tank, a, 100, 100);
+        }
+    }
+    _register_dev(file, NULL);
+    if(!ok) {
+        cout << "crash_run failed with seed " << seed << "\n";
+    }
+    return ok;
+}
+
+void test_crash_1(void) {
+    // power cut at a random write - after it, torn in the middle of it or before it
+    bool ok = true;
+    for(uint32_t seed = 1; seed <= CRASH_RUNS; seed++) {
+        ok = ok && crash_run(seed, sim_fault_t::NONE, true, true);
+        ok = ok && crash_run(seed, sim_fault_t::TORN, true, true);
+        ok = ok && crash_run(seed, sim_fault_t::DROP, true, true);
+    }
+    ASSERT("test_crash_1", ok)
+}
+
+void test_crash_2(void) {
+    // bit flips are detected and corrected from the mirror
+    bool ok = true;
+    for(uint32_t seed = 1; seed <= CRASH_RUNS; seed++) {
+        ok = ok && crash_run(seed, sim_fault_t::BIT_FLIP, false, true);
+    }
+    ASSERT("test_crash_2", ok)
+}
+
+void test_crash_3(void) {
+    // silently dropped writes, and torn ones which leave the old page intact, can not be
+    // detected by the checksum, but must not break the tank
+    bool ok = true;
+    for(uint32_t seed = 1; seed <= CRASH_RUNS; seed++) {
+        ok = ok && crash_run(seed, sim_fault_t::DROP, false, false);
+        ok = ok && crash_run(seed, sim_fault_t::TORN, false, false);
+    }
+    ASSERT("test_crash_3", ok)
+}
+
+/* @brief Convert a legacy tank with a power cut at its nth write, then remount
+ *
+ * @return true if the remounted tank holds all the legacy attributes
+ */
+static bool crash_migrate(int count, size_t size, size_t nth, sim_fault_t fault) {
+    char *file = "sim.dat";
+    SIM_DEV dev(NUM_PAGES * PAGE_SIZE, nth);
+    _register_dev(file, &dev);
+    legacy_tank(file, count, size);
+    bool ok = true;
+    dev.inject(nth, fault, true);
+    {
+        ATTR_TANK tank(file);
+    }
+    dev.clear_fault();
+    dev.power_on();
+    for(int remount = 0; remount < 2; remount++) {
+        ATTR_TANK tank(file);
+        ok = ok && gpNvm_Result::SUCCESS == tank.get_mount_status() && legacy_check(tank, count, size);
+    }
+    _register_dev(file, NULL);
+    if(!ok) {
+        cout << "crash_migrate failed at write " << nth << " of " << count << " attributes\n";
+    }
+    return ok;
+}
+
+void test_crash_4(void) {
+    // power cut after or in the middle of every write of a conversion from the legacy layout,
+    // with the entries in PAGE_0 only and with entries staged
+    char *file = "sim.dat";
+    int counts[] = {10, 100};
+    size_t sizes[] = {200, 20};
+    bool ok = true;
+    for(int c = 0; c < 2; c++) {
+        size_t writes;
+        {
+            SIM_DEV dev(NUM_PAGES * PAGE_SIZE);
+            _register_dev(file, &dev);
+            legacy_tank(file, counts[c], sizes[c]);
+            writes = dev.get_writes();
+            {
+                ATTR_TANK tank(file);
+            }
+            writes = dev.get_writes() - writes;
+            _register_dev(file, NULL);
+        }
+        for(size_t nth = 1; nth <= writes; nth++) {
+            ok = ok && crash_migrate(counts[c], sizes[c], nth, sim_fault_t::NONE);
+            ok = ok && crash_migrate(counts[c], sizes[c], nth, sim_fault_t::TORN);
+        }
+    }
+    ASSERT("test_crash_4", ok)
+}
+
 int main(void) {
     cout << "File read/write tests\n";
     test1();
@@ -318,16 +1047,38 @@ int main(void) {
     test_cache8();
     test_cache9();
     test_cache10();
+    test_cache11();
 
     cout << "ATTR_TANK tests\n";
     test_attr_1();
     test_attr_2();
     test_attr_3();
     test_attr_4();
+    test_attr_5();
+    test_attr_6();
+    test_attr_7();
+    test_attr_8();
+    test_attr_9();
+    test_attr_10();
+    test_attr_11();
+    test_attr_12();
+    test_attr_13();
+    test_attr_14();
+    test_ns_1();
+
+    cout << "Compression tests\n";
+    test_lz_1();
 
     cout << "Mem corruption tests\n";
     test_mem_1();
     test_mem_2();
+    test_sim_1();
+
+    cout << "Crash recovery tests\n";
+    test_crash_1();
+    test_crash_2();
+    test_crash_3();
+    test_crash_4();
 
     cout << "All tests passed\n";
     return 0;